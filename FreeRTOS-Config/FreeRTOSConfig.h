@@ -10,7 +10,13 @@
 #define configTICK_RATE_HZ                      1000      
 #define configMAX_PRIORITIES                    4
 #define configSYSTEM_CALL_STACK_SIZE            256     
+#ifdef CITY_HOST_BUILD
+/* The POSIX port runs each task on a pthread, which refuses
+stacks smaller than PTHREAD_STACK_MIN (even at a quarter of this). */
+#define configMINIMAL_STACK_SIZE                8192
+#else
 #define configMINIMAL_STACK_SIZE                256     
+#endif
 #define configMAX_TASK_NAME_LEN                 16
 #define configUSE_16_BIT_TICKS                  0
 #define configIDLE_SHOULD_YIELD                 1
@@ -32,7 +38,11 @@
 /* Memory allocation related definitions. */
 #define configSUPPORT_STATIC_ALLOCATION         0
 #define configSUPPORT_DYNAMIC_ALLOCATION        1
+#ifdef CITY_HOST_BUILD
+#define configTOTAL_HEAP_SIZE                   ( 4 * 1024 * 1024 )
+#else
 #define configTOTAL_HEAP_SIZE                   50000
+#endif
 #define configAPPLICATION_ALLOCATED_HEAP        0
 
 /* Hook function related definitions. */
@@ -44,7 +54,7 @@
 
 /* Run time and task stats gathering related definitions. */
 #define configGENERATE_RUN_TIME_STATS           0
-#define configUSE_TRACE_FACILITY                0
+#define configUSE_TRACE_FACILITY                1
 #define configUSE_STATS_FORMATTING_FUNCTIONS    0
 
 /* Co-routine related definitions. */
@@ -98,5 +108,8 @@
 
 
 /* A header file that defines trace macro can be included here. */
+#ifndef __ASSEMBLER__
+#include "trace_hooks.h"
+#endif
 
 #endif /* FREERTOS_CONFIG_H */
@@ -0,0 +1,43 @@
+#ifndef TRACE_HOOKS_H
+#define TRACE_HOOKS_H
+
+#include <stdint.h>
+
+// the kernel side of the trace recorder (trace.c), included by
+// FreeRTOSConfig.h so the hooks below are compiled into the kernel.
+// they run with interrupts disabled, inside the kernel's own
+// critical sections, so a record is a timestamp and a few stores.
+
+typedef enum TraceRecordType
+{
+    TRACE_TASK_SWITCHED_IN = 1,
+    TRACE_QUEUE_SEND = 2,
+    TRACE_QUEUE_SEND_FAILED = 3,
+    TRACE_QUEUE_RECEIVE = 4,
+    // recorded by the city itself for the department rings,
+    // which the kernel knows nothing about
+    TRACE_JOB_ROUTED = 5,
+    TRACE_JOB_TAKEN = 6
+} TraceRecordType_t;
+
+// queues are only traced once they are given a number,
+// which keeps the benchmarks from flooding the buffer
+#define TRACE_QUEUE_UNTRACED (0)
+#define TRACE_QUEUE_INCOMING (1)
+
+void trace_task_switched_in(uint8_t task);
+void trace_record(uint8_t type, uint8_t object);
+
+// a task switched out is implied by the next one switched in,
+// so only the switch in is recorded
+#define traceTASK_SWITCHED_IN() trace_task_switched_in((uint8_t)pxCurrentTCB->uxTCBNumber)
+
+#define traceQUEUE_TRACED(pxQueue, type) \
+    do { if ((pxQueue)->uxQueueNumber != TRACE_QUEUE_UNTRACED) \
+        trace_record((type), (uint8_t)(pxQueue)->uxQueueNumber); } while (0)
+
+#define traceQUEUE_SEND(pxQueue) traceQUEUE_TRACED(pxQueue, TRACE_QUEUE_SEND)
+#define traceQUEUE_SEND_FAILED(pxQueue) traceQUEUE_TRACED(pxQueue, TRACE_QUEUE_SEND_FAILED)
+#define traceQUEUE_RECEIVE(pxQueue) traceQUEUE_TRACED(pxQueue, TRACE_QUEUE_RECEIVE)
+
+#endif
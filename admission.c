@@ -0,0 +1,191 @@
+#include "admission.h"
+#include "pico/printf.h"
+#include "task.h"
+#include "city.h"
+#include "journal.h"
+
+const char admissionPolicyNames[4][20] =
+{
+    "Block",
+    "Reject New",
+    "Drop Oldest Minor",
+    "Shed By Severity",
+};
+
+void admission_init(AdmissionControl_t *control, AdmissionPolicy_t policy)
+{
+    control->policy = policy;
+    control->accepted = 0;
+    control->blocked = 0;
+    control->rejectedMinor = 0;
+    control->rejectedMajor = 0;
+    control->evicted = 0;
+}
+
+// FreeRTOS queues can't remove an arbitrary item, so the queue
+// is rotated once, dropping the first minor event on the way.
+// the scheduler is suspended so no other producer can claim
+// the freed slot and no consumer can observe a half-rotated queue.
+static bool admission_evict_oldest_minor(QueueHandle_t queue)
+{
+    CityEvent_t cycled;
+    bool evicted = false;
+
+    vTaskSuspendAll();
+
+    UBaseType_t waiting = uxQueueMessagesWaiting(queue);
+
+    for (UBaseType_t i = 0; i < waiting; i++)
+    {
+        if (!xQueueReceive(queue, &cycled, 0)) break;
+
+        if (!evicted && cycled.severity == MINOR)
+        {
+            evicted = true;
+            journal_append(JOURNAL_DROPPED, &cycled);
+            continue;
+        }
+
+        xQueueSend(queue, &cycled, 0);
+    }
+
+    xTaskResumeAll();
+
+    return evicted;
+}
+
+static AdmissionResult_t admission_reject(AdmissionControl_t *control, const CityEvent_t *event)
+{
+    if (event->severity == MAJOR) control->rejectedMajor++;
+    else control->rejectedMinor++;
+
+    return eADMIT_REJECTED;
+}
+
+static AdmissionResult_t admission_evict_and_send(QueueHandle_t queue, AdmissionControl_t *control, const CityEvent_t *event)
+{
+    if (!admission_evict_oldest_minor(queue)) return eADMIT_REJECTED;
+
+    if (!xQueueSend(queue, event, 0)) return eADMIT_REJECTED;
+
+    control->evicted++;
+    control->accepted++;
+    return eADMIT_ACCEPTED_WITH_EVICTION;
+}
+
+// attempts to add an event to a queue without blocking,
+// and applies the queue's overload policy if it is full
+AdmissionResult_t admission_send(QueueHandle_t queue, AdmissionControl_t *control, const CityEvent_t *event)
+{
+    AdmissionResult_t result;
+
+    if (xQueueSend(queue, event, 0))
+    {
+        control->accepted++;
+        return eADMIT_ACCEPTED;
+    }
+
+    switch (control->policy)
+    {
+        case ADMIT_BLOCK:
+            control->blocked++;
+            xQueueSend(queue, event, portMAX_DELAY);
+            control->accepted++;
+            return eADMIT_ACCEPTED;
+
+        case ADMIT_DROP_OLDEST_MINOR:
+            result = admission_evict_and_send(queue, control, event);
+            if (result != eADMIT_REJECTED) return result;
+            break;
+
+        case ADMIT_SHED_BY_SEVERITY:
+            if (event->severity == MINOR) break;
+
+            result = admission_evict_and_send(queue, control, event);
+            if (result != eADMIT_REJECTED) return result;
+
+            control->blocked++;
+            if (xQueueSend(queue, event, ADMISSION_MAJOR_WAIT))
+            {
+                control->accepted++;
+                return eADMIT_ACCEPTED;
+            }
+            break;
+
+        case ADMIT_REJECT_NEW:
+        default:
+            break;
+    }
+
+    return admission_reject(control, event);
+}
+
+// a producer can't touch the events already in a ring, so a full ring
+// instead takes a major event into its small priority ring, but only
+// while the job ring holds more minor events than there are major
+// events already waiting there, one for each of them to evict.
+// the consumer takes those first, and evicts the oldest minor event
+// from the job ring for each of them. minor events never go there,
+// as they would then overtake the minor events queued before them.
+// a major event the priority ring can't take is refused at once,
+// as the dispatcher feeding the rings would otherwise hold up
+// every other department while it waits for this one.
+static bool admission_push_priority(SpscRing_t *jobRing, SpscRing_t *priorityRing,
+        const CityEvent_t *event)
+{
+    if (spsc_ring_minor_count(jobRing) <= spsc_ring_count(priorityRing)) return false;
+
+    return spsc_ring_push(priorityRing, event);
+}
+
+AdmissionResult_t admission_send_ring(SpscRing_t *jobRing, SpscRing_t *priorityRing,
+        AdmissionControl_t *control, const CityEvent_t *event)
+{
+    if (spsc_ring_push(jobRing, event))
+    {
+        control->accepted++;
+        return eADMIT_ACCEPTED;
+    }
+
+    switch (control->policy)
+    {
+        case ADMIT_BLOCK:
+            // nothing drains the rings before the scheduler starts,
+            // which is when the journal restores events into them
+            if (xTaskGetSchedulerState() == taskSCHEDULER_NOT_STARTED) break;
+
+            control->blocked++;
+            while (!spsc_ring_push(jobRing, event))
+            {
+                vTaskDelay(1);
+            }
+            control->accepted++;
+            return eADMIT_ACCEPTED;
+
+        case ADMIT_DROP_OLDEST_MINOR:
+        case ADMIT_SHED_BY_SEVERITY:
+            if (event->severity == MINOR) break;
+
+            if (admission_push_priority(jobRing, priorityRing, event))
+            {
+                control->accepted++;
+                return eADMIT_ACCEPTED_WITH_EVICTION;
+            }
+            break;
+
+        case ADMIT_REJECT_NEW:
+        default:
+            break;
+    }
+
+    return admission_reject(control, event);
+}
+
+void admission_print(const char *queue_name, const AdmissionControl_t *control)
+{
+    printf("~~ %s Queue (%s): Accepted %lu, Blocked %lu, Evicted %lu, Rejected %lu Minor / %lu Major\n",
+            queue_name, admissionPolicyNames[control->policy],
+            (unsigned long)control->accepted, (unsigned long)control->blocked,
+            (unsigned long)control->evicted,
+            (unsigned long)control->rejectedMinor, (unsigned long)control->rejectedMajor);
+}
@@ -0,0 +1,61 @@
+#ifndef ADMISSION_H
+#define ADMISSION_H
+
+#include <stdint.h>
+#include "FreeRTOS.h"
+#include "queue.h"
+#include "spsc_ring.h"
+
+// how long a major event may wait for room in a queue
+// that holds nothing but other major events.
+// rings never wait, see admission_send_ring
+#define ADMISSION_MAJOR_WAIT (pdMS_TO_TICKS(50))
+
+struct CityEvent;
+
+// what a producer does when the queue it feeds is full
+typedef enum AdmissionPolicy
+{
+    // wait for room indefinitely (the original behavior)
+    ADMIT_BLOCK = 0,
+    // refuse the incoming event
+    ADMIT_REJECT_NEW = 1,
+    // evict the oldest queued minor event, or refuse if there is none
+    ADMIT_DROP_OLDEST_MINOR = 2,
+    // refuse minor events, let major events evict the oldest minor one,
+    // and only briefly wait if the queue holds major events alone.
+    // a ring refuses them instead of waiting
+    ADMIT_SHED_BY_SEVERITY = 3
+} AdmissionPolicy_t;
+
+typedef enum AdmissionResult
+{
+    eADMIT_ACCEPTED,
+    eADMIT_ACCEPTED_WITH_EVICTION,
+    eADMIT_REJECTED
+} AdmissionResult_t;
+
+// the overload policy of a single queue,
+// along with counters of what the policy did.
+// for a ring, evictions are carried out (and counted) by its consumer,
+// and a minor event is refused rather than evicting the oldest one,
+// as the producer can't queue it behind the others once there is room
+typedef struct AdmissionControl
+{
+    AdmissionPolicy_t policy;
+    uint32_t accepted;
+    uint32_t blocked;
+    uint32_t rejectedMinor;
+    uint32_t rejectedMajor;
+    uint32_t evicted;
+} AdmissionControl_t;
+
+extern const char admissionPolicyNames[4][20];
+
+void admission_init(AdmissionControl_t *control, AdmissionPolicy_t policy);
+AdmissionResult_t admission_send(QueueHandle_t queue, AdmissionControl_t *control, const struct CityEvent *event);
+AdmissionResult_t admission_send_ring(SpscRing_t *jobRing, SpscRing_t *priorityRing,
+        AdmissionControl_t *control, const struct CityEvent *event);
+void admission_print(const char *queue_name, const AdmissionControl_t *control);
+
+#endif
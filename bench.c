@@ -0,0 +1,334 @@
+#include "bench.h"
+
+#include "pico/stdlib.h"
+#include "pico/printf.h"
+#include "FreeRTOS.h"
+#include "task.h"
+#include "queue.h"
+#include "city.h"
+#include "spsc_ring.h"
+#include "spatial.h"
+
+// microbenchmarks, run on demand from the command parser.
+// each one runs with the scheduler suspended so that only
+// the cost of the operations themselves is measured.
+// results are only printed once the scheduler is running again,
+// as printing may block on the stdio driver.
+
+static const char benchRingNames[4][16] = {"Queue", "Ring", "Queue (Batched)", "Ring (Batched)"};
+static const char benchLookupNames[3][12] = {"Grid Index", "Linear Scan", "First Free"};
+
+static void bench_report(const char *name, uint32_t hops, uint64_t elapsedUs)
+{
+    if (elapsedUs == 0) elapsedUs = 1;
+
+    printf("~~ %-16s %8lu hops/s, %5lu cycles/hop\n", name,
+            (unsigned long)(hops * 1000000ULL / elapsedUs),
+            (unsigned long)(elapsedUs * (configCPU_CLOCK_HZ / 1000000ULL) / hops));
+}
+
+// one hop is a send and a matching receive of a single event,
+// either one at a time or in batches, where the ring only
+// notifies its consumer once per batch
+void bench_ring_vs_queue(uint32_t iterations)
+{
+    QueueHandle_t queue = xQueueCreate(BENCH_BATCH_SIZE, sizeof(CityEvent_t));
+    SpscRing_t ring;
+    CityEvent_t event = {0};
+    uint64_t start;
+    uint64_t elapsedUs[4];
+
+    if (queue == NULL) return;
+
+    if (!spsc_ring_init(&ring, BENCH_BATCH_SIZE))
+    {
+        vQueueDelete(queue);
+        return;
+    }
+
+    spsc_ring_set_consumer(&ring, xTaskGetCurrentTaskHandle());
+    iterations -= iterations % BENCH_BATCH_SIZE;
+    if (iterations == 0) iterations = BENCH_BATCH_SIZE;
+
+    printf("\n~~~~ RING VS QUEUE (%lu hops) ~~~~\n", (unsigned long)iterations);
+
+    vTaskSuspendAll();
+
+    start = time_us_64();
+    for (uint32_t i = 0; i < iterations; i++)
+    {
+        xQueueSend(queue, &event, 0);
+        xQueueReceive(queue, &event, 0);
+    }
+    elapsedUs[0] = time_us_64() - start;
+
+    start = time_us_64();
+    for (uint32_t i = 0; i < iterations; i++)
+    {
+        spsc_ring_push(&ring, &event);
+        spsc_ring_pop(&ring, &event);
+    }
+    elapsedUs[1] = time_us_64() - start;
+
+    start = time_us_64();
+    for (uint32_t i = 0; i < iterations; i += BENCH_BATCH_SIZE)
+    {
+        for (uint32_t j = 0; j < BENCH_BATCH_SIZE; j++) xQueueSend(queue, &event, 0);
+        for (uint32_t j = 0; j < BENCH_BATCH_SIZE; j++) xQueueReceive(queue, &event, 0);
+    }
+    elapsedUs[2] = time_us_64() - start;
+
+    start = time_us_64();
+    for (uint32_t i = 0; i < iterations; i += BENCH_BATCH_SIZE)
+    {
+        for (uint32_t j = 0; j < BENCH_BATCH_SIZE; j++) spsc_ring_push(&ring, &event);
+        for (uint32_t j = 0; j < BENCH_BATCH_SIZE; j++) spsc_ring_pop(&ring, &event);
+    }
+    elapsedUs[3] = time_us_64() - start;
+
+    xTaskResumeAll();
+
+    for (int i = 0; i < 4; i++)
+    {
+        bench_report(benchRingNames[i], iterations, elapsedUs[i]);
+    }
+
+    // the ring notified this task as its consumer, which nothing waits for
+    ulTaskNotifyTakeIndexed(SPSC_RING_NOTIFY_INDEX, pdTRUE, 0);
+    spsc_ring_free(&ring);
+    vQueueDelete(queue);
+
+    printf("~~~~~~~~~~~~~~~~~~~~~\n");
+}
+
+static void bench_report_lookup(const char *name, uint32_t lookups, uint64_t elapsedUs, uint32_t distance)
+{
+    if (elapsedUs == 0) elapsedUs = 1;
+
+    printf("~~   %-12s %5lu cycles/lookup, mean travel %lu.%02lu cells (%lums)\n", name,
+            (unsigned long)(elapsedUs * (configCPU_CLOCK_HZ / 1000000ULL) / lookups),
+            (unsigned long)(distance / lookups), (unsigned long)(distance * 100 / lookups % 100),
+            (unsigned long)pdTICKS_TO_MS(distance * TRAVEL_TICKS_PER_CELL / lookups));
+}
+
+// compares picking the nearest free unit through the spatial index
+// against a linear scan over all units, and against the first free
+// unit as picked before units had locations. roughly half the units
+// are busy, and the same query locations are used for each method.
+void bench_spatial(uint32_t lookups)
+{
+    static const uint8_t unitCounts[] = { 4, 8, 16, SPATIAL_MAX_UNITS };
+    static uint8_t queries[BENCH_SPATIAL_QUERIES];
+    SpatialIndex_t index;
+    uint8_t locations[SPATIAL_MAX_UNITS];
+    uint32_t freeMask;
+    uint32_t distance[3];
+    uint64_t elapsedUs[3];
+    uint64_t start;
+    volatile int found;
+
+    if (lookups == 0) lookups = BENCH_SPATIAL_QUERIES;
+
+    for (int i = 0; i < BENCH_SPATIAL_QUERIES; i++) queries[i] = spatial_random_location();
+
+    printf("\n~~~~ NEAREST UNIT (%lu lookups) ~~~~\n", (unsigned long)lookups);
+
+    for (uint32_t c = 0; c < sizeof(unitCounts) / sizeof(unitCounts[0]); c++)
+    {
+        uint8_t units = unitCounts[c];
+
+        spatial_index_init(&index);
+        freeMask = 0;
+
+        for (int i = 0; i < units; i++)
+        {
+            locations[i] = spatial_random_location();
+
+            if (i == 0 || RandomNumber() % 2 == 0)
+            {
+                freeMask |= 1UL << i;
+                spatial_index_add(&index, i, locations[i]);
+            }
+        }
+
+        printf("~~ %u units, %u free\n", units, __builtin_popcount(freeMask));
+
+        vTaskSuspendAll();
+
+        distance[0] = 0;
+        start = time_us_64();
+        for (uint32_t i = 0; i < lookups; i++)
+        {
+            uint8_t query = queries[i % BENCH_SPATIAL_QUERIES];
+            found = spatial_index_nearest(&index, query);
+            distance[0] += spatial_distance(locations[found], query);
+        }
+        elapsedUs[0] = time_us_64() - start;
+
+        distance[1] = 0;
+        start = time_us_64();
+        for (uint32_t i = 0; i < lookups; i++)
+        {
+            uint8_t query = queries[i % BENCH_SPATIAL_QUERIES];
+            uint8_t nearestDistance = UINT8_MAX;
+
+            for (int j = 0; j < units; j++)
+            {
+                if (!(freeMask & (1UL << j))) continue;
+
+                uint8_t unitDistance = spatial_distance(locations[j], query);
+
+                if (unitDistance < nearestDistance)
+                {
+                    found = j;
+                    nearestDistance = unitDistance;
+                }
+            }
+
+            distance[1] += nearestDistance;
+        }
+        elapsedUs[1] = time_us_64() - start;
+
+        distance[2] = 0;
+        start = time_us_64();
+        for (uint32_t i = 0; i < lookups; i++)
+        {
+            uint8_t query = queries[i % BENCH_SPATIAL_QUERIES];
+            found = __builtin_ctz(freeMask);
+            distance[2] += spatial_distance(locations[found], query);
+        }
+        elapsedUs[2] = time_us_64() - start;
+
+        xTaskResumeAll();
+
+        for (int i = 0; i < 3; i++)
+        {
+            bench_report_lookup(benchLookupNames[i], lookups, elapsedUs[i], distance[i]);
+        }
+    }
+
+    printf("~~~~~~~~~~~~~~~~~~~~~\n");
+}
+
+// a department of its own, with a single agent, for the preemption check.
+// an agent task never exits, so it is set up on the first run and kept.
+static CityDepartment_t *benchDepartment = NULL;
+
+static CityDepartment_t *bench_preempt_department(void)
+{
+    if (benchDepartment != NULL) return benchDepartment;
+
+    CityDepartment_t *departmentData = pvPortMalloc(sizeof(CityDepartment_t));
+    if (departmentData == NULL) return NULL;
+
+    if (!InitializeDepartment(departmentData, MEDICAL, 1))
+    {
+        FreeDepartment(departmentData);
+        vPortFree(departmentData);
+        return NULL;
+    }
+
+    // jobs are handed to the agent directly, and one agent is enough
+    spsc_ring_free(&(departmentData->jobRing));
+    spsc_ring_free(&(departmentData->priorityRing));
+
+    for (uint8_t j = 1; j < departmentData->agentCount; j++)
+    {
+        spatial_index_remove(&(departmentData->freeUnits), j);
+    }
+
+    departmentData->agentCount = 1;
+    sprintf(departmentData->agentStates[0].name, "Bench-1");
+
+    if (xTaskCreate(DepartmentAgentTask, departmentData->agentStates[0].name, configMINIMAL_STACK_SIZE,
+            &(departmentData->agentStates[0]), uxTaskPriorityGet(NULL),
+            &(departmentData->agentStates[0].handle)) != pdPASS)
+    {
+        FreeDepartment(departmentData);
+        vPortFree(departmentData);
+        return NULL;
+    }
+
+    benchDepartment = departmentData;
+    return departmentData;
+}
+
+static bool bench_wait_free(CityDepartment_t *departmentData, TickType_t timeout)
+{
+    TickType_t start = xTaskGetTickCount();
+
+    while (departmentData->busyMask != 0)
+    {
+        if (xTaskGetTickCount() - start > timeout) return false;
+        vTaskDelay(1);
+    }
+
+    return true;
+}
+
+// the agent is held back while its job is assigned, so that it only
+// sees the job once everything else about the round is in place.
+// it doesn't lead the job, so a job it sees through isn't counted
+// as completed anywhere.
+static void bench_preempt_assign(CityDepartment_t *departmentData, bool preempt)
+{
+    CityDepartmentAgentState_t *agentState = &(departmentData->agentStates[0]);
+    CityEvent_t job = {0};
+
+    job.code = departmentData->code;
+    job.severity = MINOR;
+    job.units = 1;
+    job.location = agentState->location;
+    job.description = "Bench Job";
+    job.ticks = BENCH_PREEMPT_JOB_TICKS;
+    job.createdTicks = xTaskGetTickCount();
+
+    vTaskSuspend(agentState->handle);
+    AssignToFreeAgents(departmentData, &job, 1);
+    agentState->leadsEvent = false;
+    if (preempt) RequestPreemption(departmentData, xTaskGetTickCount());
+    vTaskResume(agentState->handle);
+}
+
+// checks that a preemption request reaches an agent that was
+// assigned its job but hasn't started on it yet, and that a request
+// left over from a job that finished on its own doesn't cut short
+// the agent's next one
+void bench_preempt(uint32_t rounds)
+{
+    CityDepartment_t *departmentData = bench_preempt_department();
+    CityDepartmentAgentState_t *agentState;
+    uint32_t preempted = 0;
+    uint32_t ignored = 0;
+
+    if (departmentData == NULL) return;
+    agentState = &(departmentData->agentStates[0]);
+
+    printf("\n~~~~ PREEMPTION (%lu rounds) ~~~~\n", (unsigned long)rounds);
+
+    for (uint32_t i = 0; i < rounds; i++)
+    {
+        bench_preempt_assign(departmentData, true);
+
+        if (bench_wait_free(departmentData, BENCH_PREEMPT_TIMEOUT) && agentState->preempted) preempted++;
+
+        bench_wait_free(departmentData, BENCH_PREEMPT_JOB_TICKS + BENCH_PREEMPT_TIMEOUT);
+        agentState->preempted = false;
+
+        // aimed at an agent with no job, as a request is when
+        // its job finishes just before the request is made
+        xTaskNotifyGive(agentState->handle);
+        bench_preempt_assign(departmentData, false);
+        vTaskDelay(BENCH_PREEMPT_TIMEOUT);
+
+        if ((departmentData->busyMask & AGENT_BIT(0)) && !agentState->preempted) ignored++;
+
+        bench_wait_free(departmentData, BENCH_PREEMPT_JOB_TICKS + BENCH_PREEMPT_TIMEOUT);
+        agentState->preempted = false;
+    }
+
+    printf("~~ Preempted Before Starting: %lu of %lu\n", (unsigned long)preempted, (unsigned long)rounds);
+    printf("~~ Stale Requests Ignored: %lu of %lu\n", (unsigned long)ignored, (unsigned long)rounds);
+    printf("~~ %s\n", preempted == rounds && ignored == rounds ? "Passed" : "FAILED");
+    printf("~~~~~~~~~~~~~~~~~~~~~\n");
+}
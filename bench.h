@@ -0,0 +1,19 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdint.h>
+
+#define BENCH_DEFAULT_ITERATIONS (10000)
+#define BENCH_BATCH_SIZE (32)
+#define BENCH_SPATIAL_QUERIES (256)
+// the preemption check times a short job of its own, and expects
+// a preempted agent to stop well before the job would have ended
+#define BENCH_PREEMPT_ROUNDS (5)
+#define BENCH_PREEMPT_JOB_TICKS (pdMS_TO_TICKS(200))
+#define BENCH_PREEMPT_TIMEOUT (pdMS_TO_TICKS(50))
+
+void bench_ring_vs_queue(uint32_t iterations);
+void bench_spatial(uint32_t lookups);
+void bench_preempt(uint32_t rounds);
+
+#endif
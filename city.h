@@ -0,0 +1,207 @@
+#ifndef CITY_H
+#define CITY_H
+
+// C libs
+#include <stdint.h>
+#include <stdbool.h>
+// FreeRTOS libs
+#include "FreeRTOS.h"
+#include "task.h"
+#include "queue.h"
+// Application headers
+#include "admission.h"
+#include "spsc_ring.h"
+#include "spatial.h"
+
+// *** Definitions ***
+#define NUM_DEPARTMENTS (4)
+#define NUM_EVENT_TEMPLATES (8)
+#define MAX_PREEMPTED_JOBS (4)
+// one bit per agent in the department's busy bitmaps
+#define MAX_DEPARTMENT_AGENTS (8)
+#define AGENT_BIT(unit) (1U << (unit))
+_Static_assert(MAX_DEPARTMENT_AGENTS <= 8, "the agent bitmaps are uint8_t");
+
+#define INITIAL_SLEEP (pdMS_TO_TICKS(1000))
+
+// *** Types ***
+typedef enum DepartmentCode
+{
+    MEDICAL = 0,
+    POLICE = 1,
+    FIRE = 2,
+    COVID = 3
+} DepartmentCode_t;
+typedef enum GangDispatchPolicy
+{
+    // hold every unit as it frees up, idle, until enough are held at once
+    GANG_HOLD_AND_WAIT = 0,
+    // lend held units to short single-unit jobs
+    // that will be done before the gang could start anyway
+    GANG_BACKFILL = 1
+} GangDispatchPolicy_t;
+typedef enum EventSeverity
+{
+    MINOR = 0,
+    MAJOR = 1
+} EventSeverity_t;
+// events are copied on every hop, so the enums are packed
+// into a single byte to keep the whole event at 16 bytes
+typedef struct CityEvent
+{
+    TickType_t ticks;
+    TickType_t createdTicks;
+    char *description;
+    uint8_t code : 3;       // DepartmentCode_t
+    uint8_t severity : 1;   // EventSeverity_t
+    uint8_t units : 4;
+    uint8_t location;
+    // follows the event through the journal
+    uint16_t id;
+} CityEvent_t;
+// response is measured from event creation to assignment,
+// and is only counted once for jobs that get preempted and resumed
+typedef struct CityDepartmentStats
+{
+    uint32_t assigned[2];
+    // summed over every event, which overflows 32 bits in a long simulation
+    uint64_t responseTicks[2];
+    uint32_t completed[2];
+    uint32_t preemptions;
+    uint32_t backfilled;
+    uint32_t busyTicks;
+    // unit time spent idle, held for a multi-unit event
+    uint32_t heldTicks;
+    uint32_t trips;
+    uint32_t travelTicks;
+    // events of other departments routed here for a shorter wait
+    uint32_t takenOver;
+} CityDepartmentStats_t;
+// the generation overhead is the time spent creating and admitting
+// an event, from the generator's own point of view
+typedef struct EventGeneratorStats
+{
+    uint32_t requested;
+    uint32_t emitted;
+    // how often a request had to wait for a token
+    uint32_t limited;
+    uint64_t overheadUs;
+    uint32_t overheadMaxUs;
+} EventGeneratorStats_t;
+// what only the agent itself, and whoever hands it a job, ever reads.
+// whether it is busy, and for how long, is kept by its department.
+typedef struct CityDepartmentAgentState
+{
+    bool preempted;
+    // of all the agents sharing a multi-unit event,
+    // only one reports it complete
+    bool leadsEvent;
+    // the agent's index within its department, and where it is
+    uint8_t unit;
+    uint8_t location;
+    char name[16];
+    TaskHandle_t handle;
+    // the job as it was assigned
+    CityEvent_t currentEvent;
+    struct CityDepartment *department;
+} CityDepartmentAgentState_t;
+typedef struct CityDepartment
+{
+    DepartmentCode_t code;
+    BaseType_t status;
+    // the central dispatcher is the only producer
+    // and the department manager the only consumer
+    SpscRing_t jobRing;
+    SpscRing_t priorityRing;
+    AdmissionControl_t jobAdmission;
+    uint8_t agentCount;
+    CityDepartmentAgentState_t *agentStates;
+    // the agents' hot state, packed so that counting and scanning them
+    // never touches the agents themselves. bit n stands for agent n,
+    // and both masks are only changed inside a critical section.
+    volatile uint8_t busyMask;
+    // busy on a single-unit minor job, which a major event may preempt
+    uint8_t preemptibleMask;
+    // free, but held for the multi-unit event the manager is gathering
+    // units for. only the manager changes it, inside a critical section.
+    uint8_t heldMask;
+    // when each agent's current job started, or when it was held
+    TickType_t startedTicks[MAX_DEPARTMENT_AGENTS];
+    // the length of each agent's current job, travel and merges included
+    TickType_t jobTicks[MAX_DEPARTMENT_AGENTS];
+    // the expected wait is kept up to date as jobs come and go, rather
+    // than worked out by going over the queues: the unit time of every
+    // job waiting for agents, and the sum of the busy agents' finishing
+    // times, which less the busy count times now is the time they have left.
+    // both are only changed inside a critical section.
+    uint32_t queuedTicks;
+    TickType_t busyUntilSum;
+    bool preemptive;
+    bool nearestUnit;
+    GangDispatchPolicy_t gangPolicy;
+    uint8_t preemptedCount;
+    CityEvent_t preemptedJobs[MAX_PREEMPTED_JOBS];
+    SpatialIndex_t freeUnits;
+    CityDepartmentStats_t stats;
+} CityDepartment_t;
+typedef struct CityData
+{
+    BaseType_t dispatcherStatus;
+    QueueHandle_t incomingQueue;
+    AdmissionControl_t incomingAdmission;
+    AdmissionControl_t commandAdmission;
+    CityDepartment_t departments[NUM_DEPARTMENTS];
+} CityData_t;
+typedef struct CityEventTemplate
+{
+    TickType_t minTicks;
+    TickType_t maxTicks;
+    DepartmentCode_t code;
+    EventSeverity_t severity;
+    uint8_t requiredUnits;
+    char *description;
+} CityEventTemplate_t;
+
+// *** Shared Globals ***
+extern const char departmentNames[NUM_DEPARTMENTS][10];
+extern const CityEventTemplate_t eventTemplates[NUM_EVENT_TEMPLATES];
+extern const bool eventCoalescing;
+extern const uint8_t departmentAlternates[NUM_DEPARTMENTS];
+extern uint32_t eventBacklog;
+extern EventGeneratorStats_t generatorStats;
+
+// *** Shared Functions ***
+uint32_t RandomNumber(void);
+TickType_t CityTicks(void);
+void GenerateTemplateEvent(uint8_t templateIndex, CityEvent_t *event);
+void PrintStatus(CityData_t *cityData);
+void RequestGeneratedEvents(uint32_t count);
+void SetGeneratorPace(uint32_t perSecond, uint32_t burst);
+uint32_t MeanResponseMs(CityDepartmentStats_t *stats, EventSeverity_t severity);
+uint32_t MeanTravelMs(CityDepartmentStats_t *stats);
+
+// the routing and assignment steps, shared by the tasks and the simulation
+bool InitializeDepartment(CityDepartment_t *departmentData, DepartmentCode_t code, uint32_t queueLength);
+void FreeDepartment(CityDepartment_t *departmentData);
+TickType_t ChooseDepartment(CityData_t *cityData, CityEvent_t *event);
+TickType_t ExpectedWaitTicks(CityDepartment_t *departmentData, uint8_t units);
+AdmissionResult_t RouteEvent(CityData_t *cityData, CityEvent_t *event);
+bool MergeEvent(CityData_t *cityData, CityEvent_t *event);
+TickType_t TakeMergedWork(CityDepartment_t *departmentData, const CityEvent_t *event, bool close);
+void DropMergedWork(CityDepartment_t *departmentData, const CityEvent_t *event);
+bool TakeResumedJob(CityDepartment_t *departmentData, CityEvent_t *event);
+bool TakeNextJob(CityDepartment_t *departmentData, CityEvent_t *event);
+void RecordAssignment(CityDepartment_t *departmentData, CityEvent_t *event);
+uint8_t JobUnits(CityDepartment_t *departmentData, const CityEvent_t *event);
+bool DispatchJob(CityDepartment_t *departmentData, CityEvent_t *event, uint8_t units);
+bool AssignToFreeAgents(CityDepartment_t *departmentData, CityEvent_t *event, uint8_t units);
+CityDepartmentAgentState_t *RequestPreemption(CityDepartment_t *departmentData, TickType_t now);
+bool FinishAgentJob(CityDepartmentAgentState_t *agentState);
+TickType_t AgentRemainingTicks(CityDepartment_t *departmentData, uint8_t unit, TickType_t now);
+void ExtendJob(CityDepartment_t *departmentData, const CityEvent_t *event, TickType_t ticks);
+AdmissionResult_t AdmitEvent(CityData_t *cityData, AdmissionControl_t *control, CityEvent_t *event);
+
+// *** Shared Tasks ***
+void DepartmentAgentTask(void *param);
+
+#endif
@@ -0,0 +1,180 @@
+#include "coalesce.h"
+
+#include "pico/stdlib.h"
+#include "pico/printf.h"
+#include "task.h"
+
+// written by the dispatcher, the managers and the agents,
+// so every access is made inside a critical section
+CoalesceTable_t coalesceTable = {0};
+
+static CoalesceTable_t *coalesceActive = &coalesceTable;
+
+void coalesce_use(CoalesceTable_t *table)
+{
+    coalesceActive = table;
+}
+
+// descriptions are shared between departments, as with injected
+// events, so a report is only the same incident for the same departments.
+// an event routed elsewhere by the dispatcher still maps to the same ones.
+static uint8_t coalesce_departments(const CityEvent_t *event)
+{
+    return (1 << event->code) | departmentAlternates[event->code];
+}
+
+static uint8_t coalesce_hash(const char *description, uint8_t location, uint8_t departments)
+{
+    uint32_t key = ((uint32_t)((uintptr_t)description >> 2) * 31 + location) * 31 + departments;
+
+    return (key ^ (key >> 5)) % COALESCE_SLOTS;
+}
+
+// an incident has at most one entry, within a few probes of its hash
+static CoalesceEntry_t *coalesce_find(const CityEvent_t *event)
+{
+    uint8_t departments = coalesce_departments(event);
+    uint8_t slot = coalesce_hash(event->description, event->location, departments);
+
+    for (int i = 0; i < COALESCE_PROBES; i++)
+    {
+        CoalesceEntry_t *entry = &(coalesceActive->entries[(slot + i) % COALESCE_SLOTS]);
+
+        if (entry->description == event->description && entry->location == event->location
+                && entry->departments == departments)
+            return entry;
+    }
+
+    return NULL;
+}
+
+static CoalesceEntry_t *coalesce_find_job(const CityEvent_t *event)
+{
+    CoalesceEntry_t *entry = coalesce_find(event);
+
+    return entry != NULL && entry->id == event->id ? entry : NULL;
+}
+
+bool coalesce_merge(const CityEvent_t *event, CityEvent_t *job, TickType_t *extension)
+{
+    bool merged = false;
+    TickType_t now = CityTicks();
+
+    taskENTER_CRITICAL();
+
+    CoalesceEntry_t *entry = coalesce_find(event);
+
+    if (entry != NULL && entry->open && now - entry->lastSeen <= COALESCE_WINDOW)
+    {
+        uint8_t units = event->units > 0 ? event->units : 1;
+
+        *extension = event->ticks * COALESCE_EXTEND_PERCENT / 100;
+        job->description = (char *)entry->description;
+        job->location = entry->location;
+        job->code = entry->code;
+        job->units = entry->units;
+        job->id = entry->id;
+        entry->pendingTicks += *extension;
+        entry->lastSeen = now;
+        coalesceActive->stats.merged++;
+        coalesceActive->stats.savedTicks += event->ticks * units - *extension;
+        coalesceActive->stats.savedUnits += units;
+        merged = true;
+    }
+
+    taskEXIT_CRITICAL();
+
+    return merged;
+}
+
+// takes the incident's own entry if it has one, else a closed one,
+// else the one reported least recently. an entry still holding merged
+// time its job hasn't taken up is never taken, so that the time is
+// never lost, and the event goes unrecorded if there is no other.
+void coalesce_record(const CityEvent_t *event)
+{
+    uint8_t departments = coalesce_departments(event);
+    uint8_t slot = coalesce_hash(event->description, event->location, departments);
+    TickType_t now = CityTicks();
+
+    taskENTER_CRITICAL();
+
+    CoalesceEntry_t *entry = coalesce_find(event);
+
+    for (int i = 0; i < COALESCE_PROBES && entry == NULL; i++)
+    {
+        CoalesceEntry_t *candidate = &(coalesceActive->entries[(slot + i) % COALESCE_SLOTS]);
+        if (!candidate->open) entry = candidate;
+    }
+
+    for (int i = 0; i < COALESCE_PROBES && entry == NULL; i++)
+    {
+        CoalesceEntry_t *candidate = &(coalesceActive->entries[(slot + i) % COALESCE_SLOTS]);
+
+        if (candidate->pendingTicks > 0) continue;
+        if (entry == NULL || now - candidate->lastSeen > now - entry->lastSeen) entry = candidate;
+    }
+
+    if (entry != NULL && entry->pendingTicks == 0)
+    {
+        entry->description = event->description;
+        entry->location = event->location;
+        entry->departments = departments;
+        entry->code = event->code;
+        entry->units = event->units;
+        entry->id = event->id;
+        entry->lastSeen = now;
+        entry->open = true;
+        coalesceActive->stats.recorded++;
+    }
+
+    taskEXIT_CRITICAL();
+}
+
+TickType_t coalesce_take(const CityEvent_t *event, bool close)
+{
+    TickType_t pending = 0;
+
+    taskENTER_CRITICAL();
+
+    CoalesceEntry_t *entry = coalesce_find_job(event);
+
+    if (entry != NULL && entry->open)
+    {
+        pending = entry->pendingTicks;
+        entry->pendingTicks = 0;
+        if (close && pending == 0) entry->open = false;
+    }
+
+    taskEXIT_CRITICAL();
+
+    return pending;
+}
+
+TickType_t coalesce_drop(const CityEvent_t *event)
+{
+    TickType_t pending = 0;
+
+    taskENTER_CRITICAL();
+
+    CoalesceEntry_t *entry = coalesce_find_job(event);
+
+    if (entry != NULL)
+    {
+        pending = entry->pendingTicks;
+        entry->pendingTicks = 0;
+        entry->open = false;
+    }
+
+    taskEXIT_CRITICAL();
+
+    return pending;
+}
+
+void coalesce_print_stats(const CoalesceTable_t *table)
+{
+    printf("~~ Coalesced: %lu Merged Into %lu Routed, Saved %lu Units, %lums Of Unit Time\n",
+            (unsigned long)table->stats.merged, (unsigned long)table->stats.recorded,
+            (unsigned long)table->stats.savedUnits,
+            (unsigned long)pdTICKS_TO_MS(table->stats.savedTicks));
+}
@@ -0,0 +1,77 @@
+#ifndef COALESCE_H
+#define COALESCE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "FreeRTOS.h"
+#include "city.h"
+
+// repeated reports of the same incident (same template, same place,
+// and the same departments able to handle it) are merged into the job already routed for it, queued or under way,
+// which is extended a little rather than taking another queue slot
+// and another unit. the dispatcher keeps the recently routed events
+// in a small open-addressed hash table, and a job stays open to merges
+// until its lead agent finishes it, or it is dropped.
+#define COALESCE_SLOTS (32)
+#define COALESCE_PROBES (4)
+// how long after the last report of an incident another one still merges
+#define COALESCE_WINDOW (pdMS_TO_TICKS(10000))
+// how much of a duplicate's own duration is added to the job
+#define COALESCE_EXTEND_PERCENT (25)
+
+typedef struct CoalesceEntry
+{
+    const char *description;
+    TickType_t lastSeen;
+    // merged in, but not yet taken up by the job
+    TickType_t pendingTicks;
+    uint16_t id;
+    uint8_t location;
+    // the departments that can handle the incident, which unlike the
+    // one the job was routed to is the same for every report of it
+    uint8_t departments;
+    // the department the job was routed to, and the units it requires
+    uint8_t code;
+    uint8_t units;
+    bool open;
+} CoalesceEntry_t;
+
+typedef struct CoalesceStats
+{
+    uint32_t recorded;
+    uint32_t merged;
+    // the unit time the duplicates would have taken, less the extensions
+    uint32_t savedTicks;
+    uint32_t savedUnits;
+} CoalesceStats_t;
+
+typedef struct CoalesceTable
+{
+    CoalesceEntry_t entries[COALESCE_SLOTS];
+    CoalesceStats_t stats;
+} CoalesceTable_t;
+
+// the table the city's own tasks merge into
+extern CoalesceTable_t coalesceTable;
+
+// the simulation has a dispatcher of its own, and switches
+// to a table of its own while it runs
+void coalesce_use(CoalesceTable_t *table);
+
+// the dispatcher's side: merges a duplicate into its open job
+// if there is one, and reports the job and how much it was extended by,
+// or else records the event as the one to merge into,
+// once the department it is routed to is chosen
+bool coalesce_merge(const CityEvent_t *event, CityEvent_t *job, TickType_t *extension);
+void coalesce_record(const CityEvent_t *event);
+
+// returns the time merged into the job since it was last taken up.
+// every agent on the job takes it as it finishes, and the lead agent
+// closes the job once there is nothing more to take.
+TickType_t coalesce_take(const CityEvent_t *event, bool close);
+// returns the time merged into the job that it never took up
+TickType_t coalesce_drop(const CityEvent_t *event);
+
+void coalesce_print_stats(const CoalesceTable_t *table);
+
+#endif
@@ -0,0 +1,414 @@
+#include "command.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include "pico/stdlib.h"
+#include "pico/printf.h"
+#include "task.h"
+#include "logging.h"
+#include "bench.h"
+#include "sim.h"
+#include "monitor.h"
+#include "trace.h"
+
+// the command parser reads commands from stdio (USB CDC on the board,
+// stdin on the host) and injects events into the incoming queue.
+//
+// text commands, one per line:
+//   gen [count]                                   random events
+//   tpl <template> [count]                        events from a template
+//   ev <department> <ms> [count] [minor|major] [units] [x y]
+//                                                 explicit events
+//   press [count]                                 events from the event generator
+//   pace <per second> [burst]                     event generator rate limit
+//   log <log|status|none>                         logger behavior
+//   mask <hex>                                    logger category mask
+//   status                                        print the city status
+//   drain [seconds]                               wait for the city to go idle
+//   bench ring [iterations]                       ring vs queue microbenchmark
+//   bench spatial [lookups]                       nearest unit lookup benchmark
+//   bench preempt [rounds]                        preemption request check
+//   sim [hours] [interval ms]                     virtual time simulation
+//   sim compare <preempt|gang|nearest> [hours] [interval ms]
+//                                                 one workload under two settings
+//   monitor                                       task heartbeats and jitter
+//   trace [dump|clear]                            context switch timeline
+//   memory                                        heap and stack use
+//   quit                                          exit (host build only)
+
+CommandStats_t commandStats = {0};
+
+static char commandLine[COMMAND_LINE_LENGTH];
+static uint8_t commandLineLength = 0;
+static uint8_t commandFrame[COMMAND_FRAME_LENGTH];
+static uint8_t commandFrameLength = 0;
+
+void command_print_stats(void)
+{
+    printf("~~ Commands: %lu Lines, %lu Frames, %lu Errors, Injected %lu, Dropped %lu\n",
+            (unsigned long)commandStats.lines, (unsigned long)commandStats.frames,
+            (unsigned long)commandStats.errors,
+            (unsigned long)commandStats.injected, (unsigned long)commandStats.dropped);
+}
+
+// the command parser shares the incoming queue with the event generator,
+// so it keeps its own admission counters to avoid racing on theirs.
+// once the queue fills up, the dispatcher gets a chance to drain it
+// before anything is shed, so bulk commands aren't cut short
+// just because the parser outpaced a single routing hop.
+static void command_inject(CityData_t *cityData, CityEvent_t *event)
+{
+    if (uxQueueSpacesAvailable(cityData->incomingQueue) == 0) taskYIELD();
+
+    event->createdTicks = xTaskGetTickCount();
+
+    if (AdmitEvent(cityData, &(cityData->commandAdmission), event) == eADMIT_REJECTED)
+    {
+        commandStats.dropped++;
+    }
+    else
+    {
+        commandStats.injected++;
+    }
+}
+
+static uint32_t command_count(int argc, char **argv, int index)
+{
+    if (argc <= index) return 1;
+    return strtoul(argv[index], NULL, 10);
+}
+
+// departments can be given by code or by (a prefix of) their name
+static int command_department(const char *arg)
+{
+    char *end;
+    unsigned long code = strtoul(arg, &end, 10);
+
+    if (*end == '\0') return code < NUM_DEPARTMENTS ? (int)code : -1;
+
+    for (int i = 0; i < NUM_DEPARTMENTS; i++)
+    {
+        if (strncasecmp(arg, departmentNames[i], strlen(arg)) == 0) return i;
+    }
+
+    return -1;
+}
+
+static bool command_inject_templates(CityData_t *cityData, int templateIndex, uint32_t count)
+{
+    CityEvent_t event;
+
+    if (templateIndex >= NUM_EVENT_TEMPLATES) return false;
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        GenerateTemplateEvent(templateIndex < 0
+                ? RandomNumber() % NUM_EVENT_TEMPLATES : (uint8_t)templateIndex, &event);
+        command_inject(cityData, &event);
+    }
+
+    return true;
+}
+
+static bool command_inject_explicit(CityData_t *cityData, int argc, char **argv)
+{
+    CityEvent_t event;
+
+    if (argc < 3) return false;
+
+    int code = command_department(argv[1]);
+    if (code < 0) return false;
+
+    event.code = code;
+    event.ticks = pdMS_TO_TICKS(strtoul(argv[2], NULL, 10));
+    event.severity = argc > 4 && strcasecmp(argv[4], "major") == 0 ? MAJOR : MINOR;
+    uint32_t units = argc > 5 ? strtoul(argv[5], NULL, 10) : 1;
+
+    event.units = units > MAX_DEPARTMENT_AGENTS ? MAX_DEPARTMENT_AGENTS : units;
+    event.description = event.severity == MAJOR ? "Major Injected" : "Minor Injected";
+    // events injected at the same place report the same incident
+    event.location = argc > 7
+        ? LOCATION(strtoul(argv[6], NULL, 10) % CITY_GRID_SIZE, strtoul(argv[7], NULL, 10) % CITY_GRID_SIZE)
+        : spatial_random_location();
+
+    uint32_t count = command_count(argc, argv, 3);
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        command_inject(cityData, &event);
+    }
+
+    return true;
+}
+
+static bool command_set_logger(int argc, char **argv)
+{
+    if (argc < 2) return false;
+
+    if (strcasecmp(argv[1], "log") == 0) logger_set_behavior(PRINT_LOG);
+    else if (strcasecmp(argv[1], "status") == 0) logger_set_behavior(PRINT_STATUS);
+    else if (strcasecmp(argv[1], "none") == 0) logger_set_behavior(NONE);
+    else return false;
+
+    return true;
+}
+
+static bool command_bench(int argc, char **argv)
+{
+    uint32_t iterations = argc > 2 ? strtoul(argv[2], NULL, 10) : BENCH_DEFAULT_ITERATIONS;
+
+    if (strcmp(argv[1], "ring") == 0) bench_ring_vs_queue(iterations);
+    else if (strcmp(argv[1], "spatial") == 0) bench_spatial(iterations);
+    else if (strcmp(argv[1], "preempt") == 0)
+        bench_preempt(argc > 2 ? iterations : BENCH_PREEMPT_ROUNDS);
+    else return false;
+
+    return true;
+}
+
+static bool command_sim_compare(int argc, char **argv)
+{
+    if (argc < 3) return false;
+
+    for (int i = 0; i < SIM_COMPARISONS; i++)
+    {
+        if (strcmp(argv[2], simComparisonNames[i]) != 0) continue;
+
+        sim_compare(i, argc > 3 ? strtoul(argv[3], NULL, 10) : SIM_DEFAULT_HOURS,
+                argc > 4 ? strtoul(argv[4], NULL, 10) : SIM_DEFAULT_INTERVAL_MS);
+        return true;
+    }
+
+    return false;
+}
+
+static bool command_city_idle(CityData_t *cityData)
+{
+    if (uxQueueMessagesWaiting(cityData->incomingQueue) > 0) return false;
+
+    for (int i = 0; i < NUM_DEPARTMENTS; i++)
+    {
+        CityDepartment_t *departmentData = &(cityData->departments[i]);
+
+        if (spsc_ring_count(&(departmentData->jobRing)) > 0
+                || spsc_ring_count(&(departmentData->priorityRing)) > 0
+                || departmentData->busyMask != 0
+                || departmentData->heldMask != 0
+                || departmentData->preemptedCount > 0
+                || departmentData->queuedTicks > 0)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// waits until every event injected so far is handled, so that whatever
+// follows starts from an idle city. the dispatcher and the managers each
+// hold an event for a moment between taking it and passing it on,
+// so the city has to read as idle twice in a row.
+static void command_drain(CityData_t *cityData, uint32_t seconds)
+{
+    TickType_t start = xTaskGetTickCount();
+    TickType_t timeout = pdMS_TO_TICKS(seconds * 1000);
+    uint8_t idlePolls = 0;
+
+    while (idlePolls < 2)
+    {
+        if (xTaskGetTickCount() - start > timeout)
+        {
+            printf("~~ Not Drained After %lus\n", (unsigned long)seconds);
+            return;
+        }
+
+        vTaskDelay(COMMAND_DRAIN_POLL);
+        idlePolls = command_city_idle(cityData) ? idlePolls + 1 : 0;
+    }
+
+    printf("~~ Drained In %lums\n", (unsigned long)pdTICKS_TO_MS(xTaskGetTickCount() - start));
+}
+
+static bool command_trace(int argc, char **argv)
+{
+    if (argc < 2) trace_print_stats();
+    else if (strcmp(argv[1], "dump") == 0) trace_dump();
+    else if (strcmp(argv[1], "clear") == 0) trace_clear();
+    else return false;
+
+    return true;
+}
+
+static bool command_execute(CityData_t *cityData, char *line)
+{
+    char *argv[COMMAND_MAX_ARGS];
+    int argc = 0;
+    char *token = strtok(line, " \t\r");
+
+    while (token != NULL && argc < COMMAND_MAX_ARGS)
+    {
+        argv[argc++] = token;
+        token = strtok(NULL, " \t\r");
+    }
+
+    if (argc == 0) return true;
+
+    if (strcmp(argv[0], "gen") == 0)
+        return command_inject_templates(cityData, -1, command_count(argc, argv, 1));
+
+    if (strcmp(argv[0], "tpl") == 0)
+        return argc > 1 && command_inject_templates(cityData,
+                (int)strtoul(argv[1], NULL, 10), command_count(argc, argv, 2));
+
+    if (strcmp(argv[0], "ev") == 0)
+        return command_inject_explicit(cityData, argc, argv);
+
+    if (strcmp(argv[0], "press") == 0)
+    {
+        RequestGeneratedEvents(command_count(argc, argv, 1));
+        return true;
+    }
+
+    if (strcmp(argv[0], "pace") == 0 && argc > 1)
+    {
+        SetGeneratorPace(strtoul(argv[1], NULL, 10),
+                argc > 2 ? strtoul(argv[2], NULL, 10) : 0);
+        return true;
+    }
+
+    if (strcmp(argv[0], "log") == 0)
+        return command_set_logger(argc, argv);
+
+    if (strcmp(argv[0], "mask") == 0 && argc > 1)
+    {
+        logger_set_category_mask((uint8_t)strtoul(argv[1], NULL, 16));
+        return true;
+    }
+
+    if (strcmp(argv[0], "sim") == 0 && argc > 1 && strcmp(argv[1], "compare") == 0)
+        return command_sim_compare(argc, argv);
+
+    if (strcmp(argv[0], "sim") == 0)
+    {
+        sim_run(argc > 1 ? strtoul(argv[1], NULL, 10) : SIM_DEFAULT_HOURS,
+                argc > 2 ? strtoul(argv[2], NULL, 10) : SIM_DEFAULT_INTERVAL_MS);
+        return true;
+    }
+
+    if (strcmp(argv[0], "drain") == 0)
+    {
+        command_drain(cityData, argc > 1 ? strtoul(argv[1], NULL, 10) : COMMAND_DRAIN_SECONDS);
+        return true;
+    }
+
+    if (strcmp(argv[0], "monitor") == 0)
+    {
+        monitor_print();
+        return true;
+    }
+
+    if (strcmp(argv[0], "memory") == 0)
+    {
+        monitor_print_memory();
+        return true;
+    }
+
+    if (strcmp(argv[0], "trace") == 0)
+        return command_trace(argc, argv);
+
+    if (strcmp(argv[0], "status") == 0)
+    {
+        PrintStatus(cityData);
+        return true;
+    }
+
+    if (strcmp(argv[0], "bench") == 0 && argc > 1)
+        return command_bench(argc, argv);
+
+#ifdef CITY_HOST_BUILD
+    if (strcmp(argv[0], "quit") == 0)
+    {
+        PrintStatus(cityData);
+        exit(0);
+    }
+#endif
+
+    return false;
+}
+
+static void command_execute_frame(CityData_t *cityData)
+{
+    uint32_t count = commandFrame[2] | (commandFrame[3] << 8);
+
+    commandStats.frames++;
+
+    if (!command_inject_templates(cityData, commandFrame[1], count))
+    {
+        commandStats.errors++;
+    }
+}
+
+// feeds one input byte to the parser, a frame marker
+// is only recognized at the start of a line
+static void command_feed(CityData_t *cityData, uint8_t c)
+{
+    if (commandFrameLength > 0 || (commandLineLength == 0 && c == COMMAND_FRAME_START))
+    {
+        commandFrame[commandFrameLength++] = c;
+
+        if (commandFrameLength == COMMAND_FRAME_LENGTH)
+        {
+            command_execute_frame(cityData);
+            commandFrameLength = 0;
+        }
+
+        return;
+    }
+
+    if (c == '\n')
+    {
+        commandLine[commandLineLength] = '\0';
+        commandLineLength = 0;
+        commandStats.lines++;
+
+        if (!command_execute(cityData, commandLine))
+        {
+            commandStats.errors++;
+            printf("Unknown Command.\n");
+        }
+
+        return;
+    }
+
+    // overlong lines are truncated rather than split into two commands
+    if (commandLineLength < COMMAND_LINE_LENGTH - 1)
+    {
+        commandLine[commandLineLength++] = c;
+    }
+}
+
+// the command task drains everything stdio has buffered on each wakeup,
+// and only sleeps for a tick once input runs dry
+void CommandTask(void *param)
+{
+    CityData_t *cityData = (CityData_t *)param;
+    uint8_t heartbeat = monitor_register("Command", 1);
+    vTaskDelay(INITIAL_SLEEP);
+
+    for(;;)
+    {
+        int c = getchar_timeout_us(0);
+
+        if (c == PICO_ERROR_TIMEOUT)
+        {
+            vTaskDelay(1);
+            monitor_tick(heartbeat);
+            continue;
+        }
+
+        // a command may legitimately run for a long time (sim, bench)
+        monitor_beat(heartbeat, MONITOR_IDLE);
+        command_feed(cityData, (uint8_t)c);
+    }
+}
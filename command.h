@@ -0,0 +1,34 @@
+#ifndef COMMAND_H
+#define COMMAND_H
+
+#include <stdint.h>
+#include "city.h"
+
+#define COMMAND_LINE_LENGTH (64)
+#define COMMAND_MAX_ARGS (8)
+// drain polls the city this often, and gives up after this long by default
+#define COMMAND_DRAIN_POLL (pdMS_TO_TICKS(50))
+#define COMMAND_DRAIN_SECONDS (60)
+
+// a binary command frame is this marker byte followed by
+// a template index and a little-endian 16 bit event count,
+// for producers that would rather not format text
+#define COMMAND_FRAME_START (0xA5)
+#define COMMAND_FRAME_LENGTH (4)
+
+typedef struct CommandStats
+{
+    uint32_t lines;
+    uint32_t frames;
+    uint32_t injected;
+    uint32_t dropped;
+    uint32_t errors;
+} CommandStats_t;
+
+extern CommandStats_t commandStats;
+
+void command_print_stats(void);
+
+void CommandTask(void *param);
+
+#endif
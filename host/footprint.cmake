@@ -0,0 +1,146 @@
+# runs the host build under a fixed workload and reports its memory
+# footprint: the peak heap use, the stack headroom each task kept, and
+# the static RAM of every object in the map file. fails if any of it
+# is over budget. run through the footprint target, which defines
+# PROGRAM, MAP_FILE, WORK_DIR, HEAP_BUDGET, STACK_MIN_FREE and STATIC_RAM_BUDGET.
+#
+# the figures are the host build's own (64 bit pointers, pthread-sized
+# stacks), so they are meant to be compared from commit to commit,
+# not against the firmware's heap. the memory command gives those.
+
+# every event is handled before the memory figures are taken,
+# so that no run is measured with more of them in flight than another
+set(workload
+"log none
+tpl 0 2
+tpl 1
+tpl 2 2
+tpl 3
+tpl 4 2
+tpl 5
+tpl 6 2
+tpl 7
+ev police 3000 3 minor 1 5 5
+ev medical 4000 2 major 2 9 3
+drain 90
+sim 24 2000
+memory
+quit
+")
+
+# a journal left over from an earlier run would be restored at boot,
+# and the restore allocates a buffer of its own
+file(MAKE_DIRECTORY ${WORK_DIR})
+file(REMOVE ${WORK_DIR}/city_flash.bin)
+file(WRITE ${WORK_DIR}/workload.txt "${workload}")
+
+execute_process(
+    COMMAND ${PROGRAM}
+    INPUT_FILE ${WORK_DIR}/workload.txt
+    OUTPUT_VARIABLE output
+    RESULT_VARIABLE result
+    WORKING_DIRECTORY ${WORK_DIR}
+    TIMEOUT 120
+)
+
+if (NOT result EQUAL 0)
+    message(FATAL_ERROR "footprint: the workload run failed (${result})")
+endif()
+
+if (NOT output MATCHES "Drained In")
+    message(FATAL_ERROR "footprint: the workload's events were not all handled in time")
+endif()
+
+set(failed FALSE)
+
+# heap
+if (NOT output MATCHES "Heap: Size ([0-9]+), Free ([0-9]+), Peak Used ([0-9]+)")
+    message(FATAL_ERROR "footprint: no heap figures in the output of the workload run")
+endif()
+
+set(heap_size ${CMAKE_MATCH_1})
+set(heap_peak ${CMAKE_MATCH_3})
+message(STATUS "Heap: peak ${heap_peak} of ${heap_size} bytes, budget ${HEAP_BUDGET}")
+
+if (heap_peak GREATER HEAP_BUDGET)
+    message(SEND_ERROR "footprint: peak heap ${heap_peak} is over its budget of ${HEAP_BUDGET}")
+    set(failed TRUE)
+endif()
+
+# stacks
+string(REGEX MATCHALL "Stack Min Free +[0-9]+ Words: [^\n]+" stacks "${output}")
+
+foreach(stack IN LISTS stacks)
+    string(REGEX MATCH "Min Free +([0-9]+) Words: (.+)" match "${stack}")
+    set(words ${CMAKE_MATCH_1})
+    set(task ${CMAKE_MATCH_2})
+    message(STATUS "Stack: ${task} kept ${words} words free")
+
+    if (words LESS STACK_MIN_FREE)
+        message(SEND_ERROR "footprint: ${task} kept only ${words} words of stack free, ${STACK_MIN_FREE} required")
+        set(failed TRUE)
+    endif()
+endforeach()
+
+# static RAM, from the .data and .bss input sections of each object.
+# a long section name pushes its address and size onto the next line.
+file(STRINGS ${MAP_FILE} lines)
+set(objects "")
+set(pending FALSE)
+
+foreach(line IN LISTS lines)
+    set(size "")
+
+    if (line MATCHES "^ (\\.data|\\.bss|COMMON)[^ ]*$")
+        set(pending TRUE)
+        continue()
+    elseif (pending AND line MATCHES "^ +0x[0-9a-f]+ +0x([0-9a-f]+) +(.+)$")
+        set(size ${CMAKE_MATCH_1})
+        set(object ${CMAKE_MATCH_2})
+    elseif (line MATCHES "^ (\\.data|\\.bss|COMMON)[^ ]* +0x[0-9a-f]+ +0x([0-9a-f]+) +(.+)$")
+        set(size ${CMAKE_MATCH_2})
+        set(object ${CMAKE_MATCH_3})
+    endif()
+
+    set(pending FALSE)
+    if (size STREQUAL "")
+        continue()
+    endif()
+
+    string(MAKE_C_IDENTIFIER "${object}" key)
+    if (NOT DEFINED ram_${key})
+        set(ram_${key} 0)
+        list(APPEND objects "${object}")
+    endif()
+
+    math(EXPR ram_${key} "${ram_${key}} + 0x${size}")
+endforeach()
+
+# the kernel's heap array is covered by the heap budget,
+# so only the application's own objects count against this one
+set(static_total 0)
+
+foreach(object IN LISTS objects)
+    string(MAKE_C_IDENTIFIER "${object}" key)
+
+    if (ram_${key} EQUAL 0)
+        continue()
+    endif()
+
+    message(STATUS "Static RAM: ${ram_${key}} bytes in ${object}")
+
+    if (object MATCHES "CMakeFiles/program\\.dir/")
+        math(EXPR static_total "${static_total} + ${ram_${key}}")
+    endif()
+endforeach()
+
+message(STATUS "Static RAM: ${static_total} bytes in the application, budget ${STATIC_RAM_BUDGET}")
+
+if (static_total GREATER STATIC_RAM_BUDGET)
+    message(SEND_ERROR "footprint: static RAM ${static_total} is over its budget of ${STATIC_RAM_BUDGET}")
+    set(failed TRUE)
+endif()
+
+if (failed)
+    message(FATAL_ERROR "footprint: over budget")
+endif()
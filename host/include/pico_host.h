@@ -0,0 +1,86 @@
+#ifndef PICO_HOST_H
+#define PICO_HOST_H
+
+// stand-ins for the parts of the pico SDK the application uses,
+// so that it can run natively on the FreeRTOS POSIX port.
+// every pico/ and hardware/ header in this directory resolves here.
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <time.h>
+
+typedef unsigned int uint;
+typedef uint64_t absolute_time_t;
+typedef void (*gpio_irq_callback_t)(uint gpio, uint32_t events);
+
+#define PICO_ERROR_TIMEOUT (-1)
+
+#define GPIO_IN (false)
+#define GPIO_OUT (true)
+#define GPIO_IRQ_EDGE_RISE (0x8u)
+#define GPIO_FUNC_PWM (4)
+
+#define PWM_CHAN_A (0)
+#define PWM_CHAN_B (1)
+
+// time
+absolute_time_t get_absolute_time(void);
+uint32_t to_ms_since_boot(absolute_time_t t);
+uint64_t to_us_since_boot(absolute_time_t t);
+uint64_t time_us_64(void);
+uint32_t time_us_32(void);
+void sleep_ms(uint32_t ms);
+
+// stdio, input is read from stdin without ever blocking the scheduler
+bool stdio_init_all(void);
+int getchar_timeout_us(uint32_t timeout_us);
+
+// flash, backed by a file (city_flash.bin, or $CITY_FLASH_FILE)
+// that is mapped in place of the XIP window. like the real thing,
+// erasing sets bits and programming can only clear them.
+#define FLASH_PAGE_SIZE (1u << 8)
+#define FLASH_SECTOR_SIZE (1u << 12)
+#define PICO_FLASH_SIZE_BYTES (2 * 1024 * 1024)
+#define XIP_BASE ((uintptr_t)host_flash_base())
+
+uint8_t *host_flash_base(void);
+void flash_range_erase(uint32_t flash_offs, size_t count);
+void flash_range_program(uint32_t flash_offs, const uint8_t *data, size_t count);
+
+// nothing interrupts a host task in the middle of a flash write
+static inline uint32_t save_and_disable_interrupts(void) { return 0; }
+static inline void restore_interrupts(uint32_t status) { (void)status; }
+
+// a host process has no watchdog to reset it
+static inline void watchdog_enable(uint32_t delay_ms, bool pause_on_debug) { (void)delay_ms; (void)pause_on_debug; }
+static inline void watchdog_update(void) {}
+static inline bool watchdog_caused_reboot(void) { return false; }
+
+// peripherals, which have nothing to drive on the host
+static inline void rtc_init(void) {}
+
+static inline void gpio_init(uint gpio) { (void)gpio; }
+static inline void gpio_set_dir(uint gpio, bool out) { (void)gpio; (void)out; }
+static inline void gpio_put(uint gpio, bool value) { (void)gpio; (void)value; }
+static inline void gpio_set_function(uint gpio, int fn) { (void)gpio; (void)fn; }
+static inline void gpio_set_irq_enabled_with_callback(uint gpio, uint32_t events,
+        bool enabled, gpio_irq_callback_t callback)
+{
+    (void)gpio; (void)events; (void)enabled; (void)callback;
+}
+
+static inline void pwm_set_enabled(uint slice, bool enabled) { (void)slice; (void)enabled; }
+static inline void pwm_set_clkdiv_int_frac(uint slice, uint8_t integer, uint8_t fract)
+{
+    (void)slice; (void)integer; (void)fract;
+}
+static inline void pwm_set_phase_correct(uint slice, bool phase_correct) { (void)slice; (void)phase_correct; }
+static inline void pwm_set_wrap(uint slice, uint16_t wrap) { (void)slice; (void)wrap; }
+static inline void pwm_set_chan_level(uint slice, uint channel, uint16_t level)
+{
+    (void)slice; (void)channel; (void)level;
+}
+
+#endif
@@ -0,0 +1,130 @@
+#include "pico_host.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// bytes are read from stdin in chunks and handed out one at a time
+#define HOST_INPUT_BUFFER_SIZE (256)
+
+static uint8_t hostInputBuffer[HOST_INPUT_BUFFER_SIZE];
+static ssize_t hostInputLength = 0;
+static ssize_t hostInputPosition = 0;
+static uint64_t hostBootUs = 0;
+static uint8_t *hostFlash = NULL;
+
+static uint64_t host_monotonic_us(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000ULL + (uint64_t)now.tv_nsec / 1000ULL;
+}
+
+absolute_time_t get_absolute_time(void)
+{
+    return host_monotonic_us() - hostBootUs;
+}
+
+uint32_t to_ms_since_boot(absolute_time_t t)
+{
+    return (uint32_t)(t / 1000ULL);
+}
+
+uint64_t to_us_since_boot(absolute_time_t t)
+{
+    return t;
+}
+
+uint64_t time_us_64(void)
+{
+    return get_absolute_time();
+}
+
+uint32_t time_us_32(void)
+{
+    return (uint32_t)get_absolute_time();
+}
+
+void sleep_ms(uint32_t ms)
+{
+    usleep(ms * 1000);
+}
+
+bool stdio_init_all(void)
+{
+    hostBootUs = host_monotonic_us();
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    return true;
+}
+
+// the POSIX port delivers its tick as a signal, so a blocking read
+// would either stall every task or be interrupted anyway.
+// stdin is polled instead, and end of input reads as a timeout.
+int getchar_timeout_us(uint32_t timeout_us)
+{
+    if (hostInputPosition >= hostInputLength)
+    {
+        struct pollfd input = { .fd = STDIN_FILENO, .events = POLLIN };
+
+        if (poll(&input, 1, (int)(timeout_us / 1000)) <= 0) return PICO_ERROR_TIMEOUT;
+        if (!(input.revents & POLLIN)) return PICO_ERROR_TIMEOUT;
+
+        hostInputLength = read(STDIN_FILENO, hostInputBuffer, sizeof(hostInputBuffer));
+        hostInputPosition = 0;
+
+        if (hostInputLength <= 0)
+        {
+            hostInputLength = 0;
+            return PICO_ERROR_TIMEOUT;
+        }
+    }
+
+    return hostInputBuffer[hostInputPosition++];
+}
+
+// a new flash file starts out erased. if the file can't be mapped,
+// flash lives in memory instead, and nothing survives a restart.
+uint8_t *host_flash_base(void)
+{
+    if (hostFlash != NULL) return hostFlash;
+
+    const char *path = getenv("CITY_FLASH_FILE");
+    int fd = open(path != NULL ? path : "city_flash.bin", O_RDWR | O_CREAT, 0644);
+    struct stat info;
+
+    if (fd >= 0 && fstat(fd, &info) == 0 && ftruncate(fd, PICO_FLASH_SIZE_BYTES) == 0)
+    {
+        hostFlash = mmap(NULL, PICO_FLASH_SIZE_BYTES, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (hostFlash == MAP_FAILED) hostFlash = NULL;
+        else if (info.st_size == 0) memset(hostFlash, 0xFF, PICO_FLASH_SIZE_BYTES);
+    }
+
+    if (fd >= 0) close(fd);
+
+    if (hostFlash == NULL)
+    {
+        hostFlash = malloc(PICO_FLASH_SIZE_BYTES);
+        memset(hostFlash, 0xFF, PICO_FLASH_SIZE_BYTES);
+    }
+
+    return hostFlash;
+}
+
+void flash_range_erase(uint32_t flash_offs, size_t count)
+{
+    memset(host_flash_base() + flash_offs, 0xFF, count);
+}
+
+void flash_range_program(uint32_t flash_offs, const uint8_t *data, size_t count)
+{
+    uint8_t *flash = host_flash_base() + flash_offs;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        flash[i] &= data[i];
+    }
+}
@@ -0,0 +1,308 @@
+#include "journal.h"
+
+#include <string.h>
+#include "pico/stdlib.h"
+#include "pico/printf.h"
+#include "hardware/sync.h"
+#include "FreeRTOS.h"
+#include "task.h"
+#include "sim.h"
+#include "monitor.h"
+
+#define JOURNAL_ERASED_SEQUENCE (0xFFFFFFFF)
+
+JournalStats_t journalStats = {0};
+
+// the producers fill the buffer pages round robin, sealing each one
+// once it is full, and the journal task writes out the sealed ones
+// in the same order. a page is only reused once it has been written.
+static JournalPage_t journalBuffers[JOURNAL_BUFFER_PAGES];
+static uint8_t journalFillIndex = 0;
+static uint8_t journalFlushIndex = 0;
+static volatile uint8_t journalSealedPages = 0;
+static TaskHandle_t journalTask = NULL;
+
+// only ever touched by whoever writes pages out,
+// which is the restore at boot and the journal task after it
+static uint32_t journalNextPage = 0;
+static uint32_t journalNextSequence = 0;
+static uint16_t journalNextId = 0;
+
+static const JournalPage_t *journal_flash_page(uint32_t page)
+{
+    return (const JournalPage_t *)(uintptr_t)(XIP_BASE + JOURNAL_REGION_OFFSET + page * FLASH_PAGE_SIZE);
+}
+
+// fletcher-16 over the page header and its records
+static uint16_t journal_checksum(const JournalPage_t *page)
+{
+    const uint8_t *bytes = (const uint8_t *)page->records;
+    size_t length = page->count * sizeof(JournalRecord_t);
+    uint16_t sum1 = (page->sequence ^ page->count) & 0xFF;
+    uint16_t sum2 = (page->sequence >> 8) & 0xFF;
+
+    for (size_t i = 0; i < length; i++)
+    {
+        sum1 = (sum1 + bytes[i]) % 255;
+        sum2 = (sum2 + sum1) % 255;
+    }
+
+    return (sum2 << 8) | sum1;
+}
+
+// a page that was erased, or cut short by a reset while being written, is skipped
+static bool journal_page_valid(const JournalPage_t *page)
+{
+    return page->sequence != JOURNAL_ERASED_SEQUENCE
+        && page->count <= JOURNAL_RECORDS_PER_PAGE
+        && page->checksum == journal_checksum(page);
+}
+
+static void journal_write_page(JournalPage_t *page)
+{
+    uint32_t offset = JOURNAL_REGION_OFFSET + journalNextPage * FLASH_PAGE_SIZE;
+
+    page->sequence = journalNextSequence++;
+    page->checksum = journal_checksum(page);
+
+    // flash can't be read while it is being written, and code runs from it,
+    // so everything stops for the duration. erases happen once per sector.
+    uint32_t interrupts = save_and_disable_interrupts();
+
+    if (journalNextPage % JOURNAL_PAGES_PER_SECTOR == 0)
+    {
+        flash_range_erase(offset, FLASH_SECTOR_SIZE);
+        journalStats.erases++;
+    }
+
+    flash_range_program(offset, (const uint8_t *)page, FLASH_PAGE_SIZE);
+
+    restore_interrupts(interrupts);
+
+    journalNextPage = (journalNextPage + 1) % JOURNAL_PAGES;
+    journalStats.pages++;
+}
+
+// must be called inside a critical section
+static bool journal_seal(void)
+{
+    if (journalBuffers[journalFillIndex].count == 0) return false;
+    if (journalSealedPages == JOURNAL_BUFFER_PAGES - 1) return false;
+
+    journalFillIndex = (journalFillIndex + 1) % JOURNAL_BUFFER_PAGES;
+    journalSealedPages++;
+
+    return true;
+}
+
+static void journal_flush(void)
+{
+    while (journalSealedPages > 0)
+    {
+        journal_write_page(&(journalBuffers[journalFlushIndex]));
+
+        taskENTER_CRITICAL();
+        journalBuffers[journalFlushIndex].count = 0;
+        journalFlushIndex = (journalFlushIndex + 1) % JOURNAL_BUFFER_PAGES;
+        journalSealedPages--;
+
+        // a page that filled up while every buffer was taken
+        if (journalBuffers[journalFillIndex].count == JOURNAL_RECORDS_PER_PAGE) journal_seal();
+        taskEXIT_CRITICAL();
+    }
+}
+
+uint16_t journal_next_id(void)
+{
+    taskENTER_CRITICAL();
+    uint16_t id = journalNextId++;
+    taskEXIT_CRITICAL();
+
+    return id;
+}
+
+void journal_append(JournalRecordType_t type, const CityEvent_t *event)
+{
+    bool sealed = false;
+
+    // simulated events never happened as far as the city is concerned
+    if (simulationRunning) return;
+
+    taskENTER_CRITICAL();
+
+    JournalPage_t *page = &(journalBuffers[journalFillIndex]);
+
+    if (page->count == JOURNAL_RECORDS_PER_PAGE)
+    {
+        journalStats.overflows++;
+        taskEXIT_CRITICAL();
+        return;
+    }
+
+    JournalRecord_t *record = &(page->records[page->count++]);
+
+    record->id = event->id;
+    record->type = type;
+    record->code = event->code;
+    record->severity = event->severity;
+    record->units = event->units;
+    record->location = event->location;
+    record->reserved = 0;
+    record->ticks = event->ticks;
+    journalStats.records++;
+
+    if (page->count == JOURNAL_RECORDS_PER_PAGE) sealed = journal_seal();
+
+    taskEXIT_CRITICAL();
+
+    if (sealed && journalTask != NULL) xTaskNotifyGive(journalTask);
+}
+
+static int journal_find(JournalRecord_t *pending, uint16_t count, uint16_t id)
+{
+    for (uint16_t i = 0; i < count; i++)
+    {
+        if (pending[i].id == id) return i;
+    }
+
+    return -1;
+}
+
+// restored events only keep what the journal holds,
+// so their description is taken from the matching template
+static char *journal_description(uint8_t code, uint8_t severity)
+{
+    for (int i = 0; i < NUM_EVENT_TEMPLATES; i++)
+    {
+        if (eventTemplates[i].code == code && eventTemplates[i].severity == severity)
+            return eventTemplates[i].description;
+    }
+
+    return "Restored";
+}
+
+// the valid page with the highest sequence is the newest, and since
+// pages are written round robin, reading on from the page after it
+// goes through the rest from oldest to newest.
+// restored events are journaled again, so that they outlive the
+// records they were restored from once the region wraps around.
+void journal_restore(CityData_t *cityData)
+{
+    JournalRecord_t *pending = pvPortMalloc(sizeof(JournalRecord_t) * JOURNAL_REPLAY_MAX);
+    uint16_t pendingCount = 0;
+    int32_t newest = -1;
+    uint32_t newestSequence = 0;
+    bool seenId = false;
+    CityEvent_t event;
+
+    for (uint32_t i = 0; i < JOURNAL_PAGES; i++)
+    {
+        const JournalPage_t *page = journal_flash_page(i);
+
+        if (journal_page_valid(page) && (newest < 0 || page->sequence > newestSequence))
+        {
+            newest = i;
+            newestSequence = page->sequence;
+        }
+    }
+
+    if (newest < 0 || pending == NULL)
+    {
+        vPortFree(pending);
+        return;
+    }
+
+    for (uint32_t i = 1; i <= JOURNAL_PAGES; i++)
+    {
+        const JournalPage_t *page = journal_flash_page((newest + i) % JOURNAL_PAGES);
+
+        if (!journal_page_valid(page)) continue;
+
+        for (uint16_t j = 0; j < page->count; j++)
+        {
+            const JournalRecord_t *record = &(page->records[j]);
+            int found = journal_find(pending, pendingCount, record->id);
+
+            if (record->type == JOURNAL_ADMITTED)
+            {
+                // restored events are journaled again under their old ids,
+                // and ids wrap around, so the newest is the one furthest ahead
+                if (!seenId || (int16_t)(record->id - journalNextId) >= 0)
+                {
+                    journalNextId = record->id + 1;
+                    seenId = true;
+                }
+
+                if (found >= 0) pending[found] = *record;
+                else if (pendingCount < JOURNAL_REPLAY_MAX) pending[pendingCount++] = *record;
+                else journalStats.overflows++;
+            }
+            else if (found >= 0)
+            {
+                pending[found] = pending[--pendingCount];
+            }
+        }
+    }
+
+    journalNextPage = (newest + 1) % JOURNAL_PAGES;
+    journalNextSequence = newestSequence + 1;
+
+    for (uint16_t i = 0; i < pendingCount; i++)
+    {
+        event.id = pending[i].id;
+        event.code = pending[i].code;
+        event.severity = pending[i].severity;
+        event.units = pending[i].units;
+        event.location = pending[i].location;
+        event.ticks = pending[i].ticks;
+        event.createdTicks = CityTicks();
+        event.description = journal_description(event.code, event.severity);
+
+        if (RouteEvent(cityData, &event) != eADMIT_REJECTED)
+        {
+            eventBacklog++;
+            journalStats.restored++;
+            journal_append(JOURNAL_ADMITTED, &event);
+        }
+        else
+        {
+            journal_append(JOURNAL_DROPPED, &event);
+        }
+
+        // the journal task isn't running yet, so full pages are written here
+        journal_flush();
+    }
+
+    vPortFree(pending);
+}
+
+void journal_print_stats(void)
+{
+    printf("~~ Journal: Records %lu, Pages %lu, Erases %lu, Overflows %lu, Restored %lu\n",
+            (unsigned long)journalStats.records, (unsigned long)journalStats.pages,
+            (unsigned long)journalStats.erases, (unsigned long)journalStats.overflows,
+            (unsigned long)journalStats.restored);
+}
+
+// writes out pages as they fill up, and a partly filled one
+// if nothing has filled it within the flush interval
+void JournalTask(void *param)
+{
+    uint8_t heartbeat = monitor_register("Journal", 0);
+
+    journalTask = xTaskGetCurrentTaskHandle();
+
+    for(;;)
+    {
+        monitor_beat(heartbeat, JOURNAL_FLUSH_INTERVAL + MONITOR_GRACE);
+
+        if (ulTaskNotifyTake(pdTRUE, JOURNAL_FLUSH_INTERVAL) == 0)
+        {
+            taskENTER_CRITICAL();
+            journal_seal();
+            taskEXIT_CRITICAL();
+        }
+
+        journal_flush();
+    }
+}
@@ -0,0 +1,88 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "hardware/flash.h"
+#include "city.h"
+
+// the journal follows every event from the moment it is admitted
+// until it is completed or dropped, so that whatever was still
+// queued or in progress when the board reset can be restored.
+// records are batched into page-sized buffers in RAM, and a low
+// priority task writes full pages to a region at the end of flash.
+// pages are written round robin through the whole region, so each
+// sector is erased once per lap, and the newest page is found
+// at boot by its sequence number.
+#define JOURNAL_SECTORS (64)
+#define JOURNAL_REGION_SIZE (JOURNAL_SECTORS * FLASH_SECTOR_SIZE)
+#define JOURNAL_REGION_OFFSET (PICO_FLASH_SIZE_BYTES - JOURNAL_REGION_SIZE)
+#define JOURNAL_PAGES (JOURNAL_REGION_SIZE / FLASH_PAGE_SIZE)
+#define JOURNAL_PAGES_PER_SECTOR (FLASH_SECTOR_SIZE / FLASH_PAGE_SIZE)
+
+#define JOURNAL_RECORDS_PER_PAGE ((FLASH_PAGE_SIZE - 8) / sizeof(JournalRecord_t))
+#define JOURNAL_BUFFER_PAGES (4)
+// a partly filled page is written out if nothing else filled it by then
+#define JOURNAL_FLUSH_INTERVAL (pdMS_TO_TICKS(5000))
+// how many unfinished events a replay can restore
+#define JOURNAL_REPLAY_MAX (512)
+
+typedef enum JournalRecordType
+{
+    JOURNAL_ADMITTED = 1,
+    JOURNAL_COMPLETED = 2,
+    JOURNAL_DROPPED = 3,
+    // a repeated report, merged into the job for the same incident
+    JOURNAL_MERGED = 4
+} JournalRecordType_t;
+
+typedef struct JournalRecord
+{
+    uint16_t id;
+    uint8_t type;       // JournalRecordType_t
+    uint8_t code;       // DepartmentCode_t
+    uint8_t severity;   // EventSeverity_t
+    uint8_t units;
+    uint8_t location;
+    uint8_t reserved;
+    uint32_t ticks;
+} JournalRecord_t;
+
+// an erased page reads as all ones, which no written page's sequence is
+typedef struct JournalPage
+{
+    uint32_t sequence;
+    uint16_t count;
+    uint16_t checksum;
+    JournalRecord_t records[JOURNAL_RECORDS_PER_PAGE];
+    uint8_t padding[FLASH_PAGE_SIZE - 8 - JOURNAL_RECORDS_PER_PAGE * sizeof(JournalRecord_t)];
+} JournalPage_t;
+
+typedef struct JournalStats
+{
+    uint32_t records;
+    uint32_t pages;
+    uint32_t erases;
+    uint32_t overflows;
+    uint32_t restored;
+} JournalStats_t;
+
+extern JournalStats_t journalStats;
+
+// finds where the journal left off, and routes every event it
+// still holds as unfinished back to its department.
+// runs once at boot, before the scheduler is started, so routing
+// never waits for room: an event its department can't take
+// is journaled as dropped, and isn't restored again.
+void journal_restore(CityData_t *cityData);
+
+uint16_t journal_next_id(void);
+
+// safe to call from any task, never waits on flash
+void journal_append(JournalRecordType_t type, const CityEvent_t *event);
+
+void journal_print_stats(void);
+
+void JournalTask(void *param);
+
+#endif
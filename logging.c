@@ -1,10 +1,14 @@
 #include "logging.h"
 
-const char logFormats[15][LOG_MAX_LENGTH] =
+#include "FreeRTOS.h"
+#include "task.h"
+
+const char logFormats[19][LOG_MAX_LENGTH] =
 {
     "Central Dispatcher Starting...\n",
     "Central Dispatcher Awaiting Messages.\n",
-    "Central Dispatcher Routing \"%s Event\" to %s Department.\n",
+    "Central Dispatcher Routing \"%s Event\" to %s, Wait %lums.\n",
+    "Central Dispatcher Merging \"%s Event\" Into %s Department Job.\n",
 
     "%s Department Manager Starting...\n",
     "%s Department Manager Initializing %u Agents.\n",
@@ -15,15 +19,41 @@ const char logFormats[15][LOG_MAX_LENGTH] =
     "Unit %s Awaiting Instructions.\n",
     "Unit %s Handling \"%s Event\".\n",
     "----Unit %s Finished Handling \"%s Event\".----\n",
+    "Unit %s Preempted While Handling \"%s Event\".\n",
 
     "Event Generator Starting..\n",
     "Event Generator Awaiting User Input.\n",
     "~~Emitting \"%s Event\", Estimated Handling Time: %ums.~~\n",
 
     "Logger Starting...\n",
+
+    "!!Task %s Stalled, Silent For %lums.!!\n",
+    "Task %s Recovered.\n",
 };
 
-LoggerBehavior_t loggerBehavior = PRINT_LOG;
+volatile LoggerBehavior_t loggerBehavior = PRINT_LOG;
+volatile uint8_t loggerCategoryMask = LOG_CATEGORY_ALL;
+volatile uint8_t loggerActiveMask = LOG_CATEGORY_ALL;
+
+// each setter reads what the other one writes, so without the
+// critical section a setter interrupted by the other could leave
+// the active mask out of step with both settings. the ISR variant
+// only masks interrupts, which is just as good from a task on one core.
+void logger_set_behavior(LoggerBehavior_t behavior)
+{
+    UBaseType_t savedInterruptStatus = taskENTER_CRITICAL_FROM_ISR();
+    loggerBehavior = behavior;
+    loggerActiveMask = behavior == PRINT_LOG ? loggerCategoryMask : 0;
+    taskEXIT_CRITICAL_FROM_ISR(savedInterruptStatus);
+}
+
+void logger_set_category_mask(uint8_t mask)
+{
+    UBaseType_t savedInterruptStatus = taskENTER_CRITICAL_FROM_ISR();
+    loggerCategoryMask = mask;
+    loggerActiveMask = loggerBehavior == PRINT_LOG ? mask : 0;
+    taskEXIT_CRITICAL_FROM_ISR(savedInterruptStatus);
+}
 
 void logger_print_timestamp()
 {
@@ -38,93 +68,98 @@ void logger_print_timestamp()
 
 }
 
-void logger_log_dispatcher_starting(void) 
+void logger_emit_dispatcher_starting(void) 
 {
-    if (loggerBehavior != PRINT_LOG) return;
     logger_print_timestamp();
-    printf("%s", logFormats[eLOG_DISPATCHER_WAITING]);
+    printf("%s", logFormats[eLOG_DISPATCHER_STARTING]);
 }
-void logger_log_dispatcher_waiting(void) 
+void logger_emit_dispatcher_waiting(void) 
 {
-    if (loggerBehavior != PRINT_LOG) return;
     logger_print_timestamp();
     printf("%s", logFormats[eLOG_DISPATCHER_WAITING]);
 }
-void logger_log_dispatcher_routing(char *event_name, const char *department_name) 
+void logger_emit_dispatcher_routing(char *event_name, const char *department_name, uint32_t wait_ms) 
+{
+    logger_print_timestamp();
+    printf(logFormats[eLOG_DISPATCHER_ROUTING], event_name, department_name, (unsigned long)wait_ms);
+}
+void logger_emit_dispatcher_merging(char *event_name, const char *department_name) 
 {
-    if (loggerBehavior != PRINT_LOG) return;
     logger_print_timestamp();
-    printf(logFormats[eLOG_DISPATCHER_ROUTING], event_name, department_name);
+    printf(logFormats[eLOG_DISPATCHER_MERGING], event_name, department_name);
 }
-void logger_log_manager_starting(const char *department_name) 
+void logger_emit_manager_starting(const char *department_name) 
 {
-    if (loggerBehavior != PRINT_LOG) return;
     logger_print_timestamp();
     printf(logFormats[eLOG_MANAGER_STARTING], department_name);
 }
-void logger_log_manager_initializing(const char *department_name, uint8_t numAgents) 
+void logger_emit_manager_initializing(const char *department_name, uint8_t numAgents) 
 {
-    if (loggerBehavior != PRINT_LOG) return;
     logger_print_timestamp();
     printf(logFormats[eLOG_MANAGER_INITIALIZING_AGENTS], department_name, numAgents);
 }
-void logger_log_manager_waiting(const char *department_name) 
+void logger_emit_manager_waiting(const char *department_name) 
 {
-    if (loggerBehavior != PRINT_LOG) return;
     logger_print_timestamp();
     printf(logFormats[eLOG_MANAGER_WAITING], department_name);
 }
-void logger_log_manager_routing(const char *department_name, char *event_name) 
+void logger_emit_manager_routing(const char *department_name, char *event_name) 
 {
-    if (loggerBehavior != PRINT_LOG) return;
     logger_print_timestamp();
     printf(logFormats[eLOG_MANAGER_ASSIGNING_EVENT], department_name, event_name);
 }
-void logger_log_unit_waiting(char *unit_name) 
+void logger_emit_unit_waiting(char *unit_name) 
 {
-    if (loggerBehavior != PRINT_LOG) return;
     logger_print_timestamp();
     printf(logFormats[eLOG_UNIT_AWAITING], unit_name);
 }
-void logger_log_unit_initialized(char *unit_name) 
+void logger_emit_unit_initialized(char *unit_name) 
 {
-    if (loggerBehavior != PRINT_LOG) return;
     logger_print_timestamp();
     printf(logFormats[eLOG_UNIT_INITIALIZED], unit_name);
 }
-void logger_log_unit_handling(char *unit_name, char *event_name) 
+void logger_emit_unit_handling(char *unit_name, char *event_name) 
 {
-    if (loggerBehavior != PRINT_LOG) return;
     logger_print_timestamp();
     printf(logFormats[eLOG_UNIT_HANDLING], unit_name, event_name);
 }
-void logger_log_unit_finished(char *unit_name, char *event_name) 
+void logger_emit_unit_finished(char *unit_name, char *event_name) 
 {
-    if (loggerBehavior != PRINT_LOG) return;
     logger_print_timestamp();
     printf(logFormats[eLOG_UNIT_FINISHED], unit_name, event_name);
 }
-void logger_log_eventgen_starting(void) 
+void logger_emit_unit_preempted(char *unit_name, char *event_name) 
 {
-    if (loggerBehavior != PRINT_LOG) return;
     logger_print_timestamp();
-    printf("%s", logFormats[eLOG_GENERATOR_AWAITING]);
+    printf(logFormats[eLOG_UNIT_PREEMPTED], unit_name, event_name);
+}
+void logger_emit_eventgen_starting(void) 
+{
+    logger_print_timestamp();
+    printf("%s", logFormats[eLOG_GENERATOR_STARTING]);
 }
-void logger_log_eventgen_waiting(void) 
+void logger_emit_eventgen_waiting(void) 
 {
-    if (loggerBehavior != PRINT_LOG) return;
     logger_print_timestamp();
     printf("%s", logFormats[eLOG_GENERATOR_AWAITING]);
 }
-void logger_log_eventgen_emitting(char *event_name, uint32_t event_ms) 
+void logger_emit_eventgen_emitting(char *event_name, uint32_t event_ms) 
 {
-    if (loggerBehavior != PRINT_LOG) return;
     logger_print_timestamp();
     printf(logFormats[eLOG_GENERATOR_EMITTING], event_name, event_ms);
 }
-void logger_log_logger_starting(void) 
+void logger_emit_logger_starting(void) 
 {
-    if (loggerBehavior != PRINT_LOG) return;
     logger_print_timestamp();
     printf("%s", logFormats[eLOG_LOGGER_STARTING]);
 }
+void logger_emit_monitor_stalled(const char *task_name, uint32_t silent_ms)
+{
+    logger_print_timestamp();
+    printf(logFormats[eLOG_MONITOR_STALLED], task_name, (unsigned long)silent_ms);
+}
+void logger_emit_monitor_recovered(const char *task_name)
+{
+    logger_print_timestamp();
+    printf(logFormats[eLOG_MONITOR_RECOVERED], task_name);
+}
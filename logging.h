@@ -1,17 +1,40 @@
 #ifndef LOGGING_H
 #define LOGGING_H
 
+#include <stdint.h>
 #include "pico/printf.h"
 #include "pico/util/datetime.h"
 #include "hardware/rtc.h"
 
 #define LOG_MAX_LENGTH 64
 
+// log levels, anything above LOG_LEVEL is compiled out entirely,
+// along with the evaluation of its arguments
+#define LOG_LEVEL_NONE (0)
+// event lifecycle: startup, routing, handling, completion
+#define LOG_LEVEL_INFO (1)
+// idle loop chatter: every "awaiting" message
+#define LOG_LEVEL_DEBUG (2)
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_DEBUG
+#endif
+
+// log categories, each can be switched on or off at runtime
+#define LOG_CATEGORY_DISPATCHER (1 << 0)
+#define LOG_CATEGORY_MANAGER (1 << 1)
+#define LOG_CATEGORY_UNIT (1 << 2)
+#define LOG_CATEGORY_GENERATOR (1 << 3)
+#define LOG_CATEGORY_LOGGER (1 << 4)
+#define LOG_CATEGORY_MONITOR (1 << 5)
+#define LOG_CATEGORY_ALL (0x3F)
+
 typedef const enum LogFormatId
 {
     eLOG_DISPATCHER_STARTING,
     eLOG_DISPATCHER_WAITING,
     eLOG_DISPATCHER_ROUTING,
+    eLOG_DISPATCHER_MERGING,
 
     eLOG_MANAGER_STARTING,
     eLOG_MANAGER_INITIALIZING_AGENTS,
@@ -22,12 +45,16 @@ typedef const enum LogFormatId
     eLOG_UNIT_AWAITING,
     eLOG_UNIT_HANDLING,
     eLOG_UNIT_FINISHED,
+    eLOG_UNIT_PREEMPTED,
 
     eLOG_GENERATOR_STARTING,
     eLOG_GENERATOR_AWAITING,
     eLOG_GENERATOR_EMITTING,
 
     eLOG_LOGGER_STARTING,
+
+    eLOG_MONITOR_STALLED,
+    eLOG_MONITOR_RECOVERED,
 } LogFormatId_t;
 
 typedef enum LoggerBehavior
@@ -37,29 +64,93 @@ typedef enum LoggerBehavior
     PRINT_STATUS = 2
 } LoggerBehavior_t;
 
-extern const char logFormats[15][LOG_MAX_LENGTH];
-extern LoggerBehavior_t loggerBehavior;
+extern const char logFormats[19][LOG_MAX_LENGTH];
+extern volatile LoggerBehavior_t loggerBehavior;
+extern volatile uint8_t loggerCategoryMask;
+// the category mask as it applies right now, which is empty
+// unless the logger is printing the log, so that a disabled
+// category costs a single load and branch at the call site
+extern volatile uint8_t loggerActiveMask;
 
-void logger_print_timestamp();
-
-void logger_log_dispatcher_starting(void);
-void logger_log_dispatcher_waiting(void);
-void logger_log_dispatcher_routing(char *event_name, const char *department_name);
-
-void logger_log_manager_starting(const char *department_name);
-void logger_log_manager_initializing(const char *department_name, uint8_t numAgents);
-void logger_log_manager_waiting(const char *department_name);
-void logger_log_manager_routing(const char *department_name, char *event_name);
+// both are safe to call from an ISR
+void logger_set_behavior(LoggerBehavior_t behavior);
+void logger_set_category_mask(uint8_t mask);
 
-void logger_log_unit_waiting(char *unit_name);
-void logger_log_unit_initialized(char *unit_name);
-void logger_log_unit_handling(char *unit_name, char *event_name);
-void logger_log_unit_finished(char *unit_name, char *event_name);
-
-void logger_log_eventgen_starting(void);
-void logger_log_eventgen_waiting(void);
-void logger_log_eventgen_emitting(char *event_name, uint32_t event_ms);
+void logger_print_timestamp();
 
-void logger_log_logger_starting(void);
+#define LOGGER_LOG(level, category, call) \
+    do { if ((level) <= LOG_LEVEL && (loggerActiveMask & (category))) { call; } } while (0)
+
+// the logging front end, each call is filtered
+// by level and category before anything is evaluated
+#define logger_log_dispatcher_starting() \
+    LOGGER_LOG(LOG_LEVEL_INFO, LOG_CATEGORY_DISPATCHER, logger_emit_dispatcher_starting())
+#define logger_log_dispatcher_waiting() \
+    LOGGER_LOG(LOG_LEVEL_DEBUG, LOG_CATEGORY_DISPATCHER, logger_emit_dispatcher_waiting())
+#define logger_log_dispatcher_routing(event_name, department_name, wait_ms) \
+    LOGGER_LOG(LOG_LEVEL_INFO, LOG_CATEGORY_DISPATCHER, logger_emit_dispatcher_routing(event_name, department_name, wait_ms))
+#define logger_log_dispatcher_merging(event_name, department_name) \
+    LOGGER_LOG(LOG_LEVEL_INFO, LOG_CATEGORY_DISPATCHER, logger_emit_dispatcher_merging(event_name, department_name))
+
+#define logger_log_manager_starting(department_name) \
+    LOGGER_LOG(LOG_LEVEL_INFO, LOG_CATEGORY_MANAGER, logger_emit_manager_starting(department_name))
+#define logger_log_manager_initializing(department_name, numAgents) \
+    LOGGER_LOG(LOG_LEVEL_INFO, LOG_CATEGORY_MANAGER, logger_emit_manager_initializing(department_name, numAgents))
+#define logger_log_manager_waiting(department_name) \
+    LOGGER_LOG(LOG_LEVEL_DEBUG, LOG_CATEGORY_MANAGER, logger_emit_manager_waiting(department_name))
+#define logger_log_manager_routing(department_name, event_name) \
+    LOGGER_LOG(LOG_LEVEL_INFO, LOG_CATEGORY_MANAGER, logger_emit_manager_routing(department_name, event_name))
+
+#define logger_log_unit_waiting(unit_name) \
+    LOGGER_LOG(LOG_LEVEL_DEBUG, LOG_CATEGORY_UNIT, logger_emit_unit_waiting(unit_name))
+#define logger_log_unit_initialized(unit_name) \
+    LOGGER_LOG(LOG_LEVEL_INFO, LOG_CATEGORY_UNIT, logger_emit_unit_initialized(unit_name))
+#define logger_log_unit_handling(unit_name, event_name) \
+    LOGGER_LOG(LOG_LEVEL_INFO, LOG_CATEGORY_UNIT, logger_emit_unit_handling(unit_name, event_name))
+#define logger_log_unit_finished(unit_name, event_name) \
+    LOGGER_LOG(LOG_LEVEL_INFO, LOG_CATEGORY_UNIT, logger_emit_unit_finished(unit_name, event_name))
+#define logger_log_unit_preempted(unit_name, event_name) \
+    LOGGER_LOG(LOG_LEVEL_INFO, LOG_CATEGORY_UNIT, logger_emit_unit_preempted(unit_name, event_name))
+
+#define logger_log_eventgen_starting() \
+    LOGGER_LOG(LOG_LEVEL_INFO, LOG_CATEGORY_GENERATOR, logger_emit_eventgen_starting())
+#define logger_log_eventgen_waiting() \
+    LOGGER_LOG(LOG_LEVEL_DEBUG, LOG_CATEGORY_GENERATOR, logger_emit_eventgen_waiting())
+#define logger_log_eventgen_emitting(event_name, event_ms) \
+    LOGGER_LOG(LOG_LEVEL_INFO, LOG_CATEGORY_GENERATOR, logger_emit_eventgen_emitting(event_name, event_ms))
+
+#define logger_log_logger_starting() \
+    LOGGER_LOG(LOG_LEVEL_INFO, LOG_CATEGORY_LOGGER, logger_emit_logger_starting())
+
+#define logger_log_monitor_stalled(task_name, silent_ms) \
+    LOGGER_LOG(LOG_LEVEL_INFO, LOG_CATEGORY_MONITOR, logger_emit_monitor_stalled(task_name, silent_ms))
+#define logger_log_monitor_recovered(task_name) \
+    LOGGER_LOG(LOG_LEVEL_INFO, LOG_CATEGORY_MONITOR, logger_emit_monitor_recovered(task_name))
+
+// the out-of-line back end, only ever called through the front end
+void logger_emit_dispatcher_starting(void);
+void logger_emit_dispatcher_waiting(void);
+void logger_emit_dispatcher_routing(char *event_name, const char *department_name, uint32_t wait_ms);
+void logger_emit_dispatcher_merging(char *event_name, const char *department_name);
+
+void logger_emit_manager_starting(const char *department_name);
+void logger_emit_manager_initializing(const char *department_name, uint8_t numAgents);
+void logger_emit_manager_waiting(const char *department_name);
+void logger_emit_manager_routing(const char *department_name, char *event_name);
+
+void logger_emit_unit_waiting(char *unit_name);
+void logger_emit_unit_initialized(char *unit_name);
+void logger_emit_unit_handling(char *unit_name, char *event_name);
+void logger_emit_unit_finished(char *unit_name, char *event_name);
+void logger_emit_unit_preempted(char *unit_name, char *event_name);
+
+void logger_emit_eventgen_starting(void);
+void logger_emit_eventgen_waiting(void);
+void logger_emit_eventgen_emitting(char *event_name, uint32_t event_ms);
+
+void logger_emit_logger_starting(void);
+
+void logger_emit_monitor_stalled(const char *task_name, uint32_t silent_ms);
+void logger_emit_monitor_recovered(const char *task_name);
 
 #endif
@@ -0,0 +1,216 @@
+#include "monitor.h"
+
+#include "pico/stdlib.h"
+#include "pico/printf.h"
+#include "hardware/watchdog.h"
+#include "task.h"
+#include "logging.h"
+
+static MonitorSlot_t monitorSlots[MONITOR_MAX_TASKS];
+static uint8_t monitorSlotCount = 0;
+
+uint8_t monitor_register(const char *name, TickType_t period)
+{
+    uint8_t slot = MONITOR_NO_SLOT;
+
+    taskENTER_CRITICAL();
+
+    if (monitorSlotCount < MONITOR_MAX_TASKS)
+    {
+        slot = monitorSlotCount++;
+        monitorSlots[slot] = (MonitorSlot_t){0};
+        monitorSlots[slot].name = name;
+        monitorSlots[slot].period = period;
+        monitorSlots[slot].lastBeat = xTaskGetTickCount();
+        monitorSlots[slot].within = MONITOR_IDLE;
+    }
+
+    taskEXIT_CRITICAL();
+
+    return slot;
+}
+
+static uint8_t monitor_bucket(TickType_t lateness)
+{
+    uint8_t bucket = 0;
+
+    while (lateness > 0 && bucket < MONITOR_JITTER_BUCKETS - 1)
+    {
+        lateness >>= 1;
+        bucket++;
+    }
+
+    return bucket;
+}
+
+// each slot is only written by its own task, but the monitor
+// reads the check-in time and its deadline as a pair
+void monitor_tick(uint8_t slot)
+{
+    if (slot >= MONITOR_MAX_TASKS) return;
+
+    MonitorSlot_t *monitorSlot = &(monitorSlots[slot]);
+    TickType_t now = xTaskGetTickCount();
+
+    if (monitorSlot->ticking)
+    {
+        TickType_t interval = now - monitorSlot->lastBeat;
+        TickType_t lateness = interval > monitorSlot->period ? interval - monitorSlot->period : 0;
+
+        monitorSlot->lateness[monitor_bucket(lateness)]++;
+        if (lateness > monitorSlot->maxLateness) monitorSlot->maxLateness = lateness;
+    }
+
+    taskENTER_CRITICAL();
+    monitorSlot->lastBeat = now;
+    monitorSlot->within = monitorSlot->period + MONITOR_GRACE;
+    taskEXIT_CRITICAL();
+
+    monitorSlot->ticking = true;
+    monitorSlot->beats++;
+}
+
+void monitor_beat(uint8_t slot, TickType_t within)
+{
+    if (slot >= MONITOR_MAX_TASKS) return;
+
+    MonitorSlot_t *monitorSlot = &(monitorSlots[slot]);
+
+    taskENTER_CRITICAL();
+    monitorSlot->lastBeat = xTaskGetTickCount();
+    monitorSlot->within = within;
+    taskEXIT_CRITICAL();
+
+    monitorSlot->ticking = false;
+    monitorSlot->beats++;
+}
+
+// the upper bound, in ticks, of the bucket the percentile falls in
+static TickType_t monitor_percentile(const MonitorSlot_t *monitorSlot, uint8_t percent)
+{
+    uint32_t total = 0;
+    uint32_t seen = 0;
+
+    for (int i = 0; i < MONITOR_JITTER_BUCKETS; i++) total += monitorSlot->lateness[i];
+    if (total == 0) return 0;
+
+    for (int i = 0; i < MONITOR_JITTER_BUCKETS; i++)
+    {
+        seen += monitorSlot->lateness[i];
+        if (seen * 100ULL >= (uint64_t)total * percent) return i == 0 ? 0 : (1UL << i) - 1;
+    }
+
+    return (1UL << (MONITOR_JITTER_BUCKETS - 1)) - 1;
+}
+
+void monitor_print(void)
+{
+    printf("\n~~~~ TASK MONITOR ~~~~\n");
+
+    for (int i = 0; i < monitorSlotCount; i++)
+    {
+        const MonitorSlot_t *monitorSlot = &(monitorSlots[i]);
+
+        printf("~~ %-16s %-7s Beats %lu, Stalls %lu", monitorSlot->name,
+                monitorSlot->stalled ? "STALLED" : "OK",
+                (unsigned long)monitorSlot->beats, (unsigned long)monitorSlot->stalls);
+
+        if (monitorSlot->period > 0)
+        {
+            printf(", Late p50 <=%lums, p90 <=%lums, p99 <=%lums, max %lums",
+                    (unsigned long)pdTICKS_TO_MS(monitor_percentile(monitorSlot, 50)),
+                    (unsigned long)pdTICKS_TO_MS(monitor_percentile(monitorSlot, 90)),
+                    (unsigned long)pdTICKS_TO_MS(monitor_percentile(monitorSlot, 99)),
+                    (unsigned long)pdTICKS_TO_MS(monitorSlot->maxLateness));
+        }
+
+        printf("\n");
+    }
+
+    printf("~~~~~~~~~~~~~~~~~~~~~\n");
+}
+
+// the heap figures are taken first, before the task list
+// needs a buffer of its own
+void monitor_print_memory(void)
+{
+    size_t heapFree = xPortGetFreeHeapSize();
+    size_t heapMinFree = xPortGetMinimumEverFreeHeapSize();
+    UBaseType_t taskCount = uxTaskGetNumberOfTasks();
+    TaskStatus_t *tasks = pvPortMalloc(sizeof(TaskStatus_t) * taskCount);
+
+    printf("\n~~~~ MEMORY ~~~~\n");
+    printf("~~ Heap: Size %lu, Free %lu, Peak Used %lu\n",
+            (unsigned long)configTOTAL_HEAP_SIZE, (unsigned long)heapFree,
+            (unsigned long)(configTOTAL_HEAP_SIZE - heapMinFree));
+
+    if (tasks != NULL)
+    {
+        taskCount = uxTaskGetSystemState(tasks, taskCount, NULL);
+
+        for (UBaseType_t i = 0; i < taskCount; i++)
+        {
+            printf("~~ Stack Min Free %5u Words: %s\n",
+                    (unsigned)tasks[i].usStackHighWaterMark, tasks[i].pcTaskName);
+        }
+
+        vPortFree(tasks);
+    }
+
+    printf("~~~~~~~~~~~~~~~~~~~~~\n");
+}
+
+// a monitor that wakes up late can't tell a stalled task
+// from a scheduler that was held up altogether (by a benchmark,
+// say), so it only passes judgement when it is on time itself.
+// the hardware watchdog is fed as long as nothing is stalled.
+void MonitorTask(void *param)
+{
+    uint8_t heartbeat = monitor_register("Monitor", MONITOR_PERIOD);
+    TickType_t lastWake = xTaskGetTickCount();
+
+    if (MONITOR_WATCHDOG_MS > 0)
+    {
+        if (watchdog_caused_reboot()) printf("~~ Monitor: Restarted By The Watchdog ~~\n");
+        watchdog_enable(MONITOR_WATCHDOG_MS, true);
+    }
+
+    for(;;)
+    {
+        vTaskDelay(MONITOR_PERIOD);
+        monitor_tick(heartbeat);
+
+        TickType_t now = xTaskGetTickCount();
+        bool onTime = now - lastWake <= MONITOR_PERIOD + MONITOR_GRACE;
+        bool healthy = true;
+
+        lastWake = now;
+        if (!onTime) continue;
+
+        for (int i = 0; i < monitorSlotCount; i++)
+        {
+            MonitorSlot_t *monitorSlot = &(monitorSlots[i]);
+
+            taskENTER_CRITICAL();
+            TickType_t silence = now - monitorSlot->lastBeat;
+            bool late = monitorSlot->within != MONITOR_IDLE && silence > monitorSlot->within;
+            taskEXIT_CRITICAL();
+
+            if (late && !monitorSlot->stalled)
+            {
+                monitorSlot->stalled = true;
+                monitorSlot->stalls++;
+                logger_log_monitor_stalled(monitorSlot->name, pdTICKS_TO_MS(silence));
+            }
+            else if (!late && monitorSlot->stalled)
+            {
+                monitorSlot->stalled = false;
+                logger_log_monitor_recovered(monitorSlot->name);
+            }
+
+            if (late) healthy = false;
+        }
+
+        if (MONITOR_WATCHDOG_MS > 0 && healthy) watchdog_update();
+    }
+}
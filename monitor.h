@@ -0,0 +1,64 @@
+#ifndef MONITOR_H
+#define MONITOR_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "FreeRTOS.h"
+
+// every task checks in with the monitor, either on each wakeup of
+// its periodic loop, or whenever it picks up work, along with how long
+// the work may take. a task that doesn't check in again in time is
+// reported as stalled, and the wakeups of periodic tasks are measured
+// against their nominal period.
+#define MONITOR_MAX_TASKS (32)
+#define MONITOR_PERIOD (pdMS_TO_TICKS(500))
+// how late a check-in may be before the task counts as stalled
+#define MONITOR_GRACE (pdMS_TO_TICKS(500))
+// promises no further check-in, for a task about to wait for work
+#define MONITOR_IDLE (portMAX_DELAY)
+// lateness is bucketed by powers of two: 0, 1, 2-3, 4-7 ... ticks
+#define MONITOR_JITTER_BUCKETS (12)
+#define MONITOR_NO_SLOT (0xFF)
+
+// a stalled task stops the monitor from feeding the hardware watchdog,
+// which then resets the board after this long. 0 leaves it off.
+// the benchmarks suspend the scheduler for the whole of each
+// measurement, so long runs of them will trip it as well.
+// the simulation lets everything run between slices of steps.
+#ifndef MONITOR_WATCHDOG_MS
+#define MONITOR_WATCHDOG_MS (0)
+#endif
+
+typedef struct MonitorSlot
+{
+    const char *name;
+    // 0 for tasks that only run when there is work
+    TickType_t period;
+    TickType_t lastBeat;
+    TickType_t within;
+    // whether the last check-in was a periodic wakeup,
+    // only then is the time to the next one a measure of jitter
+    bool ticking;
+    bool stalled;
+    uint32_t beats;
+    uint32_t stalls;
+    TickType_t maxLateness;
+    uint32_t lateness[MONITOR_JITTER_BUCKETS];
+} MonitorSlot_t;
+
+// returns MONITOR_NO_SLOT once every slot is taken,
+// which every other call then quietly ignores
+uint8_t monitor_register(const char *name, TickType_t period);
+
+// a wakeup of the task's periodic loop
+void monitor_tick(uint8_t slot);
+// picking up work, or going to wait for it with MONITOR_IDLE
+void monitor_beat(uint8_t slot, TickType_t within);
+
+void monitor_print(void);
+// heap use, and how close each task came to running out of stack
+void monitor_print_memory(void);
+
+void MonitorTask(void *param);
+
+#endif
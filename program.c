@@ -1,6 +1,7 @@
 // C libs
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
 // RP-2040 libs
 #include "pico/stdlib.h"
 #include "pico/printf.h"
@@ -17,26 +18,45 @@
 #include "task.h"
 #include "queue.h"
 // Application headers
+#include "city.h"
+#include "admission.h"
+#include "command.h"
 #include "logging.h"
+#include "sim.h"
+#include "journal.h"
+#include "monitor.h"
+#include "trace.h"
+#include "coalesce.h"
+#include "ratelimit.h"
 #include "notes.h"
 
 // *** Definitions ***
-#define NUM_DEPARTMENTS (4)
-
 #define TASK_STACK_SIZE (configMINIMAL_STACK_SIZE)
 #define INCOMING_QUEUE_LENGTH (256)
-#define DEPARTMENT_QUEUE_LENGTH (256)
+#define DEPARTMENT_QUEUE_LENGTH (128)
+#define DEPARTMENT_PRIORITY_QUEUE_LENGTH (4)
 
 #define LOGGER_PRIORITY (50)
 #define CENTRAL_DISPATCHER_PRIORITY (100)
 #define DEPARTMENT_DISPATCHER_PRIORITY (150)
 #define DEPARTMENT_HANDLER_PRIORITY (200)
 #define EVENT_GENERATOR_PRIORITY (250)
-
-#define INITIAL_SLEEP (pdMS_TO_TICKS(1000))
-#define EVENT_GENERATOR_SLEEP_MAX (pdMS_TO_TICKS(6000))
-#define EVENT_GENERATOR_SLEEP_MIN (pdMS_TO_TICKS(2000))
+// the kernel clamps priorities to configMAX_PRIORITIES - 1,
+// so the ones above all share the highest one.
+// flash writes and the console stay below all of them.
+#define COMMAND_PRIORITY (tskIDLE_PRIORITY + 1)
+#define JOURNAL_PRIORITY (tskIDLE_PRIORITY + 1)
+#define MONITOR_PRIORITY (configMAX_PRIORITIES - 1)
+
+// the event generator's token bucket: events per second it can keep up,
+// and how many it may emit back to back after a quiet spell
+#define EVENT_GENERATOR_RATE (5)
+#define EVENT_GENERATOR_BURST (8)
 #define LOGGER_SLEEP (pdMS_TO_TICKS(200))
+#define LCD_SLEEP (pdMS_TO_TICKS(100))
+// how long a manager may spend gathering agents for a single job
+// before it counts as stalled, a little over the longest job and trip
+#define MANAGER_STALL_TICKS (pdMS_TO_TICKS(30000))
 
 #define PIN_LCD_DIGIT_4 0
 #define PIN_LCD_SEGMENT_G 1
@@ -60,52 +80,9 @@
 
 #define SLICE_PWM_AUDIO 6
 
-// *** Types ***
-typedef enum DepartmentCode
-{
-    MEDICAL = 0,
-    POLICE = 1,
-    FIRE = 2,
-    COVID = 3
-} DepartmentCode_t;
-typedef struct CityEvent
-{
-    TickType_t ticks;
-    DepartmentCode_t code;
-    char *description;
-} CityEvent_t;
-typedef struct CityDepartmentAgentState
-{
-    bool busy;
-    char name[16];
-    CityEvent_t currentEvent;
-} CityDepartmentAgentState_t;
-typedef struct CityDepartment
-{
-    DepartmentCode_t code;
-    BaseType_t status;
-    QueueHandle_t jobQueue;
-    uint8_t agentCount;
-    CityDepartmentAgentState_t *agentStates;
-} CityDepartment_t;
-typedef struct CityData
-{
-    BaseType_t dispatcherStatus;
-    QueueHandle_t incomingQueue;
-    CityDepartment_t departments[NUM_DEPARTMENTS];
-} CityData_t;
-typedef struct CityEventTemplate
-{
-    TickType_t minTicks;
-    TickType_t maxTicks;
-    DepartmentCode_t code;
-    char *description;
-} CityEventTemplate_t;
-
 // *** Global Constants ***
 //
-// a "debouncing" cooldown for the event generation
-// and its related gpio functions
+// a "debouncing" cooldown for the gpio inputs
 const uint32_t buttonCooldownMs = 200;
 
 const char departmentNames[NUM_DEPARTMENTS][10] = {"Medical\0", "Police\0", "Fire\0", "Covid-19\0"};
@@ -113,16 +90,54 @@ const uint8_t departmentAgentCounts[NUM_DEPARTMENTS] = {4, 3, 2, 4};
 
 // Events will be generated, randomly or otherwise,
 // from this pool of event templates
-const CityEventTemplate_t eventTemplates[8] =
-{
-    {pdMS_TO_TICKS(2000),  pdMS_TO_TICKS(5000),  MEDICAL, "Minor Medical"},
-    {pdMS_TO_TICKS(6000),  pdMS_TO_TICKS(12000), MEDICAL, "Major Medical"},
-    {pdMS_TO_TICKS(2000),  pdMS_TO_TICKS(4000),  POLICE,  "Minor Criminal"},
-    {pdMS_TO_TICKS(5000),  pdMS_TO_TICKS(10000), POLICE,  "Major Criminal"},
-    {pdMS_TO_TICKS(1000),  pdMS_TO_TICKS(4000),  FIRE,    "Minor Fire"},
-    {pdMS_TO_TICKS(6000),  pdMS_TO_TICKS(16000), FIRE,    "Major Fire"},
-    {pdMS_TO_TICKS(4000),  pdMS_TO_TICKS(6000),  COVID,   "Covid-19 Isolated"},
-    {pdMS_TO_TICKS(10000), pdMS_TO_TICKS(10000), COVID,   "Covid-19 Outbreak"},
+const CityEventTemplate_t eventTemplates[NUM_EVENT_TEMPLATES] =
+{
+    {pdMS_TO_TICKS(2000),  pdMS_TO_TICKS(5000),  MEDICAL, MINOR, 1, "Minor Medical"},
+    {pdMS_TO_TICKS(6000),  pdMS_TO_TICKS(12000), MEDICAL, MAJOR, 2, "Major Medical"},
+    {pdMS_TO_TICKS(2000),  pdMS_TO_TICKS(4000),  POLICE,  MINOR, 1, "Minor Criminal"},
+    {pdMS_TO_TICKS(5000),  pdMS_TO_TICKS(10000), POLICE,  MAJOR, 2, "Major Criminal"},
+    {pdMS_TO_TICKS(1000),  pdMS_TO_TICKS(4000),  FIRE,    MINOR, 1, "Minor Fire"},
+    {pdMS_TO_TICKS(6000),  pdMS_TO_TICKS(16000), FIRE,    MAJOR, 2, "Major Fire"},
+    {pdMS_TO_TICKS(4000),  pdMS_TO_TICKS(6000),  COVID,   MINOR, 1, "Covid-19 Isolated"},
+    {pdMS_TO_TICKS(10000), pdMS_TO_TICKS(10000), COVID,   MAJOR, 3, "Covid-19 Outbreak"},
+};
+
+// what each producer does when the queue it feeds is full.
+// the incoming queue is fed by the event generator,
+// the department queues by the central dispatcher.
+const AdmissionPolicy_t incomingAdmissionPolicy = ADMIT_SHED_BY_SEVERITY;
+const AdmissionPolicy_t departmentAdmissionPolicies[NUM_DEPARTMENTS] =
+{
+    ADMIT_SHED_BY_SEVERITY,
+    ADMIT_DROP_OLDEST_MINOR,
+    ADMIT_SHED_BY_SEVERITY,
+    ADMIT_REJECT_NEW
+};
+
+// whether a department may suspend an in-progress minor job
+// to free up a unit for a major event that has none available
+const bool departmentPreemption[NUM_DEPARTMENTS] = {true, true, true, true};
+
+// how a manager gathers the units for an event that requires several
+const GangDispatchPolicy_t gangDispatchPolicy = GANG_BACKFILL;
+
+// whether a manager sends the free units nearest to an event,
+// or the first ones free, as it did before units had locations
+const bool nearestUnitDispatch = true;
+
+// whether the dispatcher merges repeated reports of an incident
+// into the job already routed for it
+const bool eventCoalescing = true;
+
+// the departments, other than its own, that can also handle
+// an event of each department. the dispatcher routes every event
+// to whichever of them is expected to get to it first.
+const uint8_t departmentAlternates[NUM_DEPARTMENTS] =
+{
+    1 << COVID,
+    0,
+    0,
+    1 << MEDICAL
 };
 
 // *** Global Variables ***
@@ -130,30 +145,44 @@ const CityEventTemplate_t eventTemplates[8] =
 
 // handle of the event generation task,
 // only exposed here to allow it
-// to be suspended/resumed via ISR
+// to be notified via ISR
 TaskHandle_t eventGeneratorHandle;
 
+// the event generator's pace, which the command parser may change,
+// so both of them only touch it inside a critical section
+RateLimiter_t generatorLimiter;
+EventGeneratorStats_t generatorStats = {0};
+
 // tracking time since last gpio HIGH
 // to enforce cooldown & debouncing
 uint32_t gpioBounceTable[30] = {0};
 
 // a counter of pending/ongoing events
 // for user feedback (in this case, LED brightness)
-uint8_t eventBacklog = 0;
+uint32_t eventBacklog = 0;
 
 // *** Function Declarations ***
 void InitializeHardware(void);
 CityData_t* InitializeCityData(void);
 void InitializeCityTasks(CityData_t *cityData);
 void InitializeHelperTasks(CityData_t *cityData);
-void PrintStatus(CityData_t *cityData);
-uint32_t RandomNumber(void);
+uint8_t CountFreeAgents(CityDepartment_t *departmentData);
+uint8_t PickFreeAgent(CityDepartment_t *departmentData, uint8_t location);
+void ReleaseAgent(CityDepartmentAgentState_t *agentState);
+void AddQueuedWork(CityDepartment_t *departmentData, const CityEvent_t *event);
+void RemoveQueuedWork(CityDepartment_t *departmentData, const CityEvent_t *event);
+void SuspendAgentJob(CityDepartmentAgentState_t *agentState, TickType_t now);
+bool PreemptionCovers(CityDepartment_t *departmentData, uint8_t units);
+bool PreemptMinorJob(CityDepartment_t *departmentData);
+TickType_t GangShadowTicks(CityDepartment_t *departmentData, uint8_t units);
+bool BackfillGangWait(CityDepartment_t *departmentData, uint8_t units);
+void HoldFreeAgents(CityDepartment_t *departmentData);
+void ReleaseHeldAgents(CityDepartment_t *departmentData, TickType_t now);
 void onGpioRise(uint gpio, uint32_t events);
 void showDigit(char character, uint8_t digit);
 // *** Task Declarations ***
 void CentralDispatcherTask(void *param);
 void DepartmentManagerTask(void *param);
-void DepartmentAgentTask(void *param);
 void LoggerTask(void *param);
 void LCDTask(void *param);
 void AudioTask(void *param);
@@ -168,6 +197,7 @@ int main(void)
 
     // application data initialization
     CityData_t *cityData = InitializeCityData();
+    journal_restore(cityData);
 
     // initial tasks creation
     InitializeCityTasks(cityData);
@@ -226,25 +256,69 @@ CityData_t* InitializeCityData(void)
 {
     CityData_t *cityData = pvPortMalloc(sizeof(CityData_t));
     cityData->incomingQueue = xQueueCreate(INCOMING_QUEUE_LENGTH, sizeof(CityEvent_t));
+    vQueueSetQueueNumber(cityData->incomingQueue, TRACE_QUEUE_INCOMING);
+    admission_init(&(cityData->incomingAdmission), incomingAdmissionPolicy);
+    admission_init(&(cityData->commandAdmission), incomingAdmissionPolicy);
 
     for (int i = 0; i < NUM_DEPARTMENTS; i++)
     {
-        cityData->departments[i].code = i;
-        cityData->departments[i].jobQueue = xQueueCreate(DEPARTMENT_QUEUE_LENGTH, sizeof(CityEvent_t));
-        cityData->departments[i].agentCount = departmentAgentCounts[i];
-        cityData->departments[i].agentStates = pvPortMalloc(sizeof(CityDepartmentAgentState_t)
-                * departmentAgentCounts[i]);
-                
-        for (int j = 0; j < departmentAgentCounts[i]; j++)
-        {
-            cityData->departments[i].agentStates[j].busy = false;
-            sprintf(cityData->departments[i].agentStates[j].name, "%s-%u", departmentNames[i], j+1);
-        }
+        if (!InitializeDepartment(&(cityData->departments[i]), i, DEPARTMENT_QUEUE_LENGTH))
+            printf("!!%s Department Out Of Memory!!\n", departmentNames[i]);
     }
 
     return cityData;
 }
 
+// the job ring holds queueLength events, a power of two.
+// returns false if the heap ran out,
+// the department can still be passed to FreeDepartment then
+bool InitializeDepartment(CityDepartment_t *departmentData, DepartmentCode_t code, uint32_t queueLength)
+{
+    departmentData->code = code;
+    bool allocated = spsc_ring_init(&(departmentData->jobRing), queueLength);
+    allocated = spsc_ring_init(&(departmentData->priorityRing), DEPARTMENT_PRIORITY_QUEUE_LENGTH)
+        && allocated;
+    admission_init(&(departmentData->jobAdmission), departmentAdmissionPolicies[code]);
+    // the agent bitmaps have no room for any more
+    departmentData->agentCount = departmentAgentCounts[code] < MAX_DEPARTMENT_AGENTS
+        ? departmentAgentCounts[code] : MAX_DEPARTMENT_AGENTS;
+    departmentData->agentStates = pvPortMalloc(sizeof(CityDepartmentAgentState_t)
+            * departmentData->agentCount);
+    departmentData->preemptive = departmentPreemption[code];
+    departmentData->nearestUnit = nearestUnitDispatch;
+    departmentData->gangPolicy = gangDispatchPolicy;
+    departmentData->preemptedCount = 0;
+    departmentData->busyMask = 0;
+    departmentData->preemptibleMask = 0;
+    departmentData->heldMask = 0;
+    departmentData->queuedTicks = 0;
+    departmentData->busyUntilSum = 0;
+    memset(&(departmentData->stats), 0, sizeof(CityDepartmentStats_t));
+    spatial_index_init(&(departmentData->freeUnits));
+
+    if (!allocated || departmentData->agentStates == NULL) return false;
+
+    for (int j = 0; j < departmentData->agentCount; j++)
+    {
+        departmentData->agentStates[j].preempted = false;
+        departmentData->agentStates[j].department = departmentData;
+        departmentData->agentStates[j].unit = j;
+        departmentData->agentStates[j].location = spatial_random_location();
+        spatial_index_add(&(departmentData->freeUnits), j, departmentData->agentStates[j].location);
+        sprintf(departmentData->agentStates[j].name, "%s-%u", departmentNames[code], j+1);
+    }
+
+    return true;
+}
+
+void FreeDepartment(CityDepartment_t *departmentData)
+{
+    spsc_ring_free(&(departmentData->jobRing));
+    spsc_ring_free(&(departmentData->priorityRing));
+    vPortFree(departmentData->agentStates);
+    departmentData->agentStates = NULL;
+}
+
 void InitializeCityTasks(CityData_t *cityData)
 {
     cityData->dispatcherStatus = xTaskCreate(
@@ -254,20 +328,36 @@ void InitializeCityTasks(CityData_t *cityData)
 
     for (int i = 0; i < NUM_DEPARTMENTS; i++)
     {
+            TaskHandle_t managerHandle = NULL;
+
             cityData->departments[i].status = xTaskCreate(
             DepartmentManagerTask,
             departmentNames[cityData->departments[i].code], TASK_STACK_SIZE,
-            &(cityData->departments[i]), DEPARTMENT_DISPATCHER_PRIORITY, NULL);
+            &(cityData->departments[i]), DEPARTMENT_DISPATCHER_PRIORITY, &managerHandle);
+
+            spsc_ring_set_consumer(&(cityData->departments[i].jobRing), managerHandle);
+            spsc_ring_set_consumer(&(cityData->departments[i].priorityRing), managerHandle);
     }
 }
 
-void GenerateRandomEvent(void)
+void GenerateTemplateEvent(uint8_t templateIndex, CityEvent_t *event)
 {
-
+    const CityEventTemplate_t *eventTemplate = &(eventTemplates[templateIndex]);
+    TickType_t spread = eventTemplate->maxTicks - eventTemplate->minTicks;
+
+    event->code = eventTemplate->code;
+    event->severity = eventTemplate->severity;
+    event->createdTicks = CityTicks();
+    event->units = eventTemplate->requiredUnits;
+    event->location = spatial_random_location();
+    event->description = eventTemplate->description;
+    event->ticks = eventTemplate->minTicks + (spread > 0 ? RandomNumber() % spread : 0);
 }
 
 void InitializeHelperTasks(CityData_t *cityData)
 {
+    ratelimit_init(&generatorLimiter, EVENT_GENERATOR_RATE, EVENT_GENERATOR_BURST, xTaskGetTickCount());
+
     xTaskCreate( LoggerTask, "Logger", TASK_STACK_SIZE,
             cityData, LOGGER_PRIORITY, NULL);
     
@@ -278,11 +368,33 @@ void InitializeHelperTasks(CityData_t *cityData)
             cityData, 25, NULL);
             
     xTaskCreate( EventGeneratorTask, "EventGenerator", TASK_STACK_SIZE,
-            &(cityData->incomingQueue), EVENT_GENERATOR_PRIORITY, &eventGeneratorHandle);
+            cityData, EVENT_GENERATOR_PRIORITY, &eventGeneratorHandle);
+
+    xTaskCreate( CommandTask, "Command", TASK_STACK_SIZE,
+            cityData, COMMAND_PRIORITY, NULL);
+
+    xTaskCreate( JournalTask, "Journal", TASK_STACK_SIZE,
+            NULL, JOURNAL_PRIORITY, NULL);
+
+    xTaskCreate( MonitorTask, "Monitor", TASK_STACK_SIZE,
+            NULL, MONITOR_PRIORITY, NULL);
+}
+
+// the city's clock, which the simulation advances on its own
+TickType_t CityTicks(void)
+{
+    return simulationRunning ? simulationTicks : xTaskGetTickCount();
 }
 
+// the simulation draws from a seeded generator of its own,
+// so that a workload can be run again under other settings
 uint32_t RandomNumber(void)
 {
+    if (simulationRunning) return sim_random();
+
+#ifdef CITY_HOST_BUILD
+    return ((uint32_t)rand() << 16) ^ (uint32_t)rand();
+#else
     int k = 0;
     int random=0;
     volatile uint32_t *rnd_reg=(uint32_t *)(ROSC_BASE + ROSC_RANDOMBIT_OFFSET);
@@ -294,6 +406,7 @@ uint32_t RandomNumber(void)
     }
 
     return random;
+#endif
 }
 
 // ISR when a gpio input is set HIGH
@@ -306,13 +419,17 @@ void onGpioRise(uint gpio, uint32_t events)
     switch (gpio)
     {
         case PIN_EVENT_GEN:
-            xTaskResumeFromISR(eventGeneratorHandle);
+        {
+            BaseType_t woken = pdFALSE;
+            vTaskNotifyGiveFromISR(eventGeneratorHandle, &woken);
+            portYIELD_FROM_ISR(woken);
             break;
+        }
         case PIN_PRINT_LOG:
-            loggerBehavior = PRINT_LOG;
+            logger_set_behavior(PRINT_LOG);
             break;
         case PIN_PRINT_STATUS:
-            loggerBehavior = PRINT_STATUS;
+            logger_set_behavior(PRINT_STATUS);
             break;
     }
 }
@@ -388,21 +505,67 @@ void showDigit(char character, uint8_t digit)
     gpio_put(PIN_LCD_SEGMENT_DP, true);
 }
 
+uint32_t MeanResponseMs(CityDepartmentStats_t *stats, EventSeverity_t severity)
+{
+    if (stats->assigned[severity] == 0) return 0;
+    return pdTICKS_TO_MS(stats->responseTicks[severity] / stats->assigned[severity]);
+}
+
+uint32_t MeanTravelMs(CityDepartmentStats_t *stats)
+{
+    if (stats->trips == 0) return 0;
+    return pdTICKS_TO_MS(stats->travelTicks / stats->trips);
+}
+
 void PrintStatus(CityData_t *cityData)
 {
-    printf("\n~~~~ CITY STATUS ~~~~\n\n~~ Unhandled Events: %u ~~\n\n",
-            eventBacklog);
+    printf("\n~~~~ CITY STATUS ~~~~\n\n~~ Unhandled Events: %lu ~~\n\n",
+            (unsigned long)eventBacklog);
+
+    admission_print("Incoming", &(cityData->incomingAdmission));
+    admission_print("Command", &(cityData->commandAdmission));
+    command_print_stats();
+    journal_print_stats();
+    coalesce_print_stats(&coalesceTable);
+    printf("~~ Generator: Requested %lu, Emitted %lu, Rate Limited %lu, Pace %lu/s Burst %lu\n",
+            (unsigned long)generatorStats.requested, (unsigned long)generatorStats.emitted,
+            (unsigned long)generatorStats.limited,
+            (unsigned long)generatorLimiter.perSecond, (unsigned long)generatorLimiter.burst);
+    printf("~~ Generation Overhead: Mean %luus, Max %luus\n",
+            (unsigned long)(generatorStats.emitted > 0
+                ? generatorStats.overheadUs / generatorStats.emitted : 0),
+            (unsigned long)generatorStats.overheadMaxUs);
+    printf("\n");
 
     for (int i = 0; i < NUM_DEPARTMENTS; i++)
     {
+        CityDepartmentStats_t *stats = &(cityData->departments[i].stats);
+        uint8_t busyMask = cityData->departments[i].busyMask;
+        uint8_t heldMask = cityData->departments[i].heldMask;
+
         printf("~ %s Department ~\n", departmentNames[i]);
+        admission_print("Job", &(cityData->departments[i].jobAdmission));
+        printf("~~ Mean Response: Minor %lums, Major %lums, Mean Travel: %lums\n",
+                (unsigned long)MeanResponseMs(stats, MINOR),
+                (unsigned long)MeanResponseMs(stats, MAJOR),
+                (unsigned long)MeanTravelMs(stats));
+        printf("~~ Completed: Minor %lu, Major %lu, Preemptions: %lu, Backfilled: %lu\n",
+                (unsigned long)stats->completed[MINOR], (unsigned long)stats->completed[MAJOR],
+                (unsigned long)stats->preemptions, (unsigned long)stats->backfilled);
+        printf("~~ Utilization: %lu%%, Held Idle: %lu%%, Expected Wait: %lums, Taken Over: %lu\n",
+                (unsigned long)(100ULL * stats->busyTicks
+                    / ((uint64_t)cityData->departments[i].agentCount * CityTicks())),
+                (unsigned long)(100ULL * stats->heldTicks
+                    / ((uint64_t)cityData->departments[i].agentCount * CityTicks())),
+                (unsigned long)pdTICKS_TO_MS(ExpectedWaitTicks(&(cityData->departments[i]), 1)),
+                (unsigned long)stats->takenOver);
 
         for (int j = 0; j < cityData->departments[i].agentCount; j++)
         {
             printf("~~ Unit %s Status: %s\n", 
                     cityData->departments[i].agentStates[j].name,
-                    cityData->departments[i].agentStates[j].busy
-                    ? "Busy" : "Free");
+                    busyMask & AGENT_BIT(j) ? "Busy"
+                    : heldMask & AGENT_BIT(j) ? "Held" : "Free");
         }
 
         printf("\n");
@@ -411,83 +574,680 @@ void PrintStatus(CityData_t *cityData)
     printf("~~~~~~~~~~~~~~~~~~~~~\n");
 }
 
+// as though the event button was pressed this many times
+void RequestGeneratedEvents(uint32_t count)
+{
+    for (uint32_t i = 0; i < count; i++)
+    {
+        xTaskNotifyGive(eventGeneratorHandle);
+    }
+}
+
+// a burst of 0 keeps the current one. the generator is woken
+// without a request, so that it waits for its next token at the new pace
+void SetGeneratorPace(uint32_t perSecond, uint32_t burst)
+{
+    taskENTER_CRITICAL();
+    ratelimit_set(&generatorLimiter, perSecond, burst > 0 ? burst : generatorLimiter.burst,
+            xTaskGetTickCount());
+    taskEXIT_CRITICAL();
+
+    xTaskNotify(eventGeneratorHandle, 0, eNoAction);
+}
+
 // *** Task Definitions ***
 
 // the central dispatcher reads events from the incoming events queue,
-// and forwards them to the appropriate department queue
+// and forwards them to the capable department with the shortest expected wait,
+// unless they merely repeat an incident that is already being handled
 void CentralDispatcherTask(void *param)
 {
     vTaskDelay(INITIAL_SLEEP);
     CityData_t *cityData = (CityData_t *)param;
     CityEvent_t handledEvent;
+    uint8_t heartbeat = monitor_register("CentralDispatcher", 0);
 
-    logger_log_dispatcher_waiting();
+    logger_log_dispatcher_starting();
 
     for(;;)
     {
         logger_log_dispatcher_waiting();
+        monitor_beat(heartbeat, MONITOR_IDLE);
 
         if (xQueueReceive(cityData->incomingQueue, &(handledEvent), portMAX_DELAY))
         {
-            logger_log_dispatcher_routing(handledEvent.description, departmentNames[handledEvent.code]);
+            monitor_beat(heartbeat, MONITOR_GRACE);
+
+            if (MergeEvent(cityData, &handledEvent))
+            {
+                logger_log_dispatcher_merging(handledEvent.description, departmentNames[handledEvent.code]);
+                journal_append(JOURNAL_MERGED, &handledEvent);
+                continue;
+            }
+
+            TickType_t expectedWait = ChooseDepartment(cityData, &handledEvent);
+
+            logger_log_dispatcher_routing(handledEvent.description,
+                    departmentNames[handledEvent.code], pdTICKS_TO_MS(expectedWait));
+
+            // recorded before it is routed, so that the job
+            // can't be finished and closed before it was ever open
+            if (eventCoalescing) coalesce_record(&handledEvent);
+
+            if (RouteEvent(cityData, &handledEvent) != eADMIT_REJECTED)
+            {
+                eventBacklog++;
+                trace_mark(TRACE_JOB_ROUTED, handledEvent.code);
+            }
+            else
+            {
+                DropMergedWork(&(cityData->departments[handledEvent.code]), &handledEvent);
+                journal_append(JOURNAL_DROPPED, &handledEvent);
+            }
+        }
+    }
+}
+
+// every event entering the city is given an id and journaled first,
+// so that its record can never trail one about its completion
+AdmissionResult_t AdmitEvent(CityData_t *cityData, AdmissionControl_t *control, CityEvent_t *event)
+{
+    event->id = journal_next_id();
+    journal_append(JOURNAL_ADMITTED, event);
+
+    AdmissionResult_t result = admission_send(cityData->incomingQueue, control, event);
+
+    if (result == eADMIT_REJECTED) journal_append(JOURNAL_DROPPED, event);
+
+    return result;
+}
+
+// a full department sheds load according to its own policy
+// instead of stalling routing for every other department.
+// events evicted to make room are taken off the backlog
+// by the department manager once it carries out the eviction.
+AdmissionResult_t RouteEvent(CityData_t *cityData, CityEvent_t *event)
+{
+    CityDepartment_t *departmentData = &(cityData->departments[event->code]);
+
+    // counted first, since the manager may take the job the moment it is pushed
+    AddQueuedWork(departmentData, event);
+
+    AdmissionResult_t result = admission_send_ring(&(departmentData->jobRing),
+            &(departmentData->priorityRing), &(departmentData->jobAdmission), event);
+
+    if (result == eADMIT_REJECTED) RemoveQueuedWork(departmentData, event);
 
-            xQueueSend(cityData->departments[handledEvent.code].jobQueue, &(handledEvent), portMAX_DELAY);
-            eventBacklog++;
+    return result;
+}
+
+// hands the event over to another capable department if that one
+// is expected to get to it sooner. returns the expected wait.
+TickType_t ChooseDepartment(CityData_t *cityData, CityEvent_t *event)
+{
+    uint8_t alternates = departmentAlternates[event->code];
+    uint8_t chosen = event->code;
+    TickType_t chosenWait = ExpectedWaitTicks(&(cityData->departments[chosen]),
+            JobUnits(&(cityData->departments[chosen]), event));
+
+    while (alternates != 0)
+    {
+        uint8_t code = __builtin_ctz(alternates);
+        TickType_t wait = ExpectedWaitTicks(&(cityData->departments[code]),
+                JobUnits(&(cityData->departments[code]), event));
+
+        alternates &= alternates - 1;
+
+        if (wait < chosenWait)
+        {
+            chosen = code;
+            chosenWait = wait;
         }
     }
+
+    if (chosen != event->code)
+    {
+        cityData->departments[chosen].stats.takenOver++;
+        event->code = chosen;
+    }
+
+    return chosenWait;
+}
+
+// nothing to wait for if enough agents are free and nothing is queued
+// ahead, otherwise the work ahead shared out between all the agents.
+// takes no account of how the work is split into jobs, so it is
+// an estimate, but one that costs the same however long the queues get.
+TickType_t ExpectedWaitTicks(CityDepartment_t *departmentData, uint8_t units)
+{
+    TickType_t now = CityTicks();
+
+    taskENTER_CRITICAL();
+    uint8_t busyCount = __builtin_popcount(departmentData->busyMask);
+    uint8_t heldCount = __builtin_popcount(departmentData->heldMask);
+    uint32_t queuedTicks = departmentData->queuedTicks;
+    int32_t busyTicks = (int32_t)(departmentData->busyUntilSum - busyCount * now);
+    taskEXIT_CRITICAL();
+
+    // agents that are running late
+    if (busyTicks < 0) busyTicks = 0;
+
+    if (queuedTicks == 0 && departmentData->agentCount - busyCount - heldCount >= units) return 0;
+
+    return (queuedTicks + busyTicks) / departmentData->agentCount;
+}
+
+void AddQueuedWork(CityDepartment_t *departmentData, const CityEvent_t *event)
+{
+    taskENTER_CRITICAL();
+    departmentData->queuedTicks += event->ticks * JobUnits(departmentData, event);
+    taskEXIT_CRITICAL();
+}
+
+void RemoveQueuedWork(CityDepartment_t *departmentData, const CityEvent_t *event)
+{
+    taskENTER_CRITICAL();
+    departmentData->queuedTicks -= event->ticks * JobUnits(departmentData, event);
+    taskEXIT_CRITICAL();
+}
+
+// a repeated report of an incident is merged into the job routed for it,
+// and takes on the job's department. the time it adds to the job counts
+// as queued work of that department until the job's agents take it up,
+// and is counted inside the same critical section as it is merged, so
+// that they can't take it up before it was ever counted.
+bool MergeEvent(CityData_t *cityData, CityEvent_t *event)
+{
+    CityEvent_t job;
+    TickType_t extension;
+
+    if (!eventCoalescing) return false;
+
+    taskENTER_CRITICAL();
+    bool merged = coalesce_merge(event, &job, &extension);
+    if (merged)
+    {
+        CityDepartment_t *departmentData = &(cityData->departments[job.code]);
+        departmentData->queuedTicks += extension * JobUnits(departmentData, &job);
+        event->code = job.code;
+    }
+    taskEXIT_CRITICAL();
+
+    return merged;
+}
+
+TickType_t TakeMergedWork(CityDepartment_t *departmentData, const CityEvent_t *event, bool close)
+{
+    taskENTER_CRITICAL();
+    TickType_t pending = coalesce_take(event, close);
+    departmentData->queuedTicks -= pending * JobUnits(departmentData, event);
+    taskEXIT_CRITICAL();
+
+    return pending;
+}
+
+void DropMergedWork(CityDepartment_t *departmentData, const CityEvent_t *event)
+{
+    taskENTER_CRITICAL();
+    TickType_t pending = coalesce_drop(event);
+    departmentData->queuedTicks -= pending * JobUnits(departmentData, event);
+    taskEXIT_CRITICAL();
 }
 
 // the department manager reads events from the department job queue,
-// and forwards them to a free agent if available. if no agent
-// is available, the manager waits until one is freed up.
+// and forwards them to as many free agents as the event requires.
+// if not enough agents are available, the manager waits until they
+// are freed up, preempting minor jobs for a major event, and lending
+// idle units to short jobs while gathering units for a large event.
+// preempted jobs are resumed before any new job is taken.
 void DepartmentManagerTask(void *param)
 {
     vTaskDelay(INITIAL_SLEEP);
     CityDepartment_t *departmentData = (CityDepartment_t *)param;
     CityEvent_t *handledEvent = pvPortMalloc(sizeof(CityEvent_t));
+    uint8_t heartbeat = monitor_register(departmentNames[departmentData->code], 0);
 
-    logger_log_manager_routing(departmentNames[handledEvent->code], handledEvent->description);
+    logger_log_manager_starting(departmentNames[departmentData->code]);
 
     for (int i = 0; i < departmentData->agentCount; i++)
     {
-        xTaskCreate(DepartmentAgentTask, handledEvent->description, TASK_STACK_SIZE,
-        &(departmentData->agentStates[i]), DEPARTMENT_HANDLER_PRIORITY, NULL);
+        xTaskCreate(DepartmentAgentTask, departmentData->agentStates[i].name, TASK_STACK_SIZE,
+        &(departmentData->agentStates[i]), DEPARTMENT_HANDLER_PRIORITY,
+        &(departmentData->agentStates[i].handle));
     }
 
     for(;;)
     {
-        logger_log_manager_waiting(departmentNames[departmentData->code]);
+        bool resumed = TakeResumedJob(departmentData, handledEvent);
 
-        if (xQueueReceive(departmentData->jobQueue, handledEvent, portMAX_DELAY))
+        if (!resumed)
         {
-            logger_log_manager_routing(departmentNames[departmentData->code], handledEvent->description);
-            bool assigned = false;
+            logger_log_manager_waiting(departmentNames[departmentData->code]);
+            monitor_beat(heartbeat, MONITOR_IDLE);
 
-            do
+            while (!TakeNextJob(departmentData, handledEvent))
             {
-                for (int i = 0; i < departmentData->agentCount; i++)
-                {
-                    if (!(departmentData->agentStates[i].busy))
-                    {
-                        departmentData->agentStates[i].currentEvent = *handledEvent;
-                        departmentData->agentStates[i].busy = true;
-                        assigned = true;
-                        break;
-                    }
-                }
-
-                vTaskDelay(10);
-
-            } while(!assigned);
+                ulTaskNotifyTakeIndexed(SPSC_RING_NOTIFY_INDEX, pdTRUE, portMAX_DELAY);
+            }
+
+            trace_mark(TRACE_JOB_TAKEN, departmentData->code);
+        }
+
+        monitor_beat(heartbeat, MANAGER_STALL_TICKS);
+
+        logger_log_manager_routing(departmentNames[departmentData->code], handledEvent->description);
+
+        uint8_t units = JobUnits(departmentData, handledEvent);
+
+        while (!DispatchJob(departmentData, handledEvent, units))
+        {
+            vTaskDelay(10);
+        }
+
+        if (!resumed) RecordAssignment(departmentData, handledEvent);
+    }
+}
+
+bool TakeResumedJob(CityDepartment_t *departmentData, CityEvent_t *event)
+{
+    if (departmentData->preemptedCount == 0) return false;
+
+    departmentData->preemptedCount--;
+    *event = departmentData->preemptedJobs[departmentData->preemptedCount];
+    RemoveQueuedWork(departmentData, event);
+
+    return true;
+}
+
+uint8_t JobUnits(CityDepartment_t *departmentData, const CityEvent_t *event)
+{
+    uint8_t units = event->units;
+
+    if (units > departmentData->agentCount) units = departmentData->agentCount;
+    if (units == 0) units = 1;
+
+    return units;
+}
+
+// hands the job to its agents, preempting minor jobs for a major event,
+// and lending idle units to short jobs while gathering units for a large one.
+// units freed by preempting are kept for the major event, not lent out.
+// returns false if the job has to wait for agents to free up.
+bool DispatchJob(CityDepartment_t *departmentData, CityEvent_t *event, uint8_t units)
+{
+    bool preempting = false;
+
+    while (!AssignToFreeAgents(departmentData, event, units))
+    {
+        if (departmentData->preemptive
+                && event->severity == MAJOR
+                && PreemptionCovers(departmentData, units)
+                && PreemptMinorJob(departmentData))
+        {
+            preempting = true;
+            continue;
+        }
+
+        if (preempting) return false;
+
+        if (units > 1
+                && departmentData->gangPolicy == GANG_BACKFILL
+                && BackfillGangWait(departmentData, units))
+        {
+            continue;
+        }
+
+        if (units > 1 && departmentData->gangPolicy == GANG_HOLD_AND_WAIT)
+        {
+            HoldFreeAgents(departmentData);
+        }
+
+        return false;
+    }
+
+    return true;
+}
+
+// major events that overflowed into the priority ring are taken first,
+// each at the expense of the oldest minor event in the job ring. the
+// producer only lets one in for a minor event that was queued, but this
+// may have taken that one in the meantime, and then the major event is
+// let through without an eviction, never more than the priority ring holds.
+bool TakeNextJob(CityDepartment_t *departmentData, CityEvent_t *event)
+{
+    CityEvent_t evicted;
+
+    if (spsc_ring_pop(&(departmentData->priorityRing), event))
+    {
+        RemoveQueuedWork(departmentData, event);
+
+        if (spsc_ring_remove_oldest_minor(&(departmentData->jobRing), &evicted))
+        {
+            RemoveQueuedWork(departmentData, &evicted);
+            departmentData->jobAdmission.evicted++;
+            eventBacklog--;
+            DropMergedWork(departmentData, &evicted);
+            journal_append(JOURNAL_DROPPED, &evicted);
+        }
+
+        return true;
+    }
+
+    if (!spsc_ring_pop(&(departmentData->jobRing), event)) return false;
+
+    RemoveQueuedWork(departmentData, event);
+
+    return true;
+}
+
+// made once the job's agents are assigned, so that the response
+// takes in the wait for units, and what preemption saves of it
+void RecordAssignment(CityDepartment_t *departmentData, CityEvent_t *event)
+{
+    departmentData->stats.assigned[event->severity]++;
+    departmentData->stats.responseTicks[event->severity] +=
+        CityTicks() - event->createdTicks;
+}
+
+// held agents are not free to take any other job
+uint8_t CountFreeAgents(CityDepartment_t *departmentData)
+{
+    return departmentData->agentCount
+        - __builtin_popcount(departmentData->busyMask | departmentData->heldMask);
+}
+
+// there must be a free agent to pick
+uint8_t PickFreeAgent(CityDepartment_t *departmentData, uint8_t location)
+{
+    if (departmentData->nearestUnit)
+        return spatial_index_nearest(&(departmentData->freeUnits), location);
+
+    uint8_t allMask = (uint8_t)((1u << departmentData->agentCount) - 1);
+
+    return __builtin_ctz(allMask & ~(departmentData->busyMask | departmentData->heldMask));
+}
+
+TickType_t AgentRemainingTicks(CityDepartment_t *departmentData, uint8_t unit, TickType_t now)
+{
+    TickType_t elapsed = now - departmentData->startedTicks[unit];
+
+    return elapsed < departmentData->jobTicks[unit]
+        ? departmentData->jobTicks[unit] - elapsed : 0;
+}
+
+// the event is only handed out once enough agents are free
+// to take it all at once, counting those held for it, which are
+// let go first. the nearest free agents are picked, unless the department
+// picks the first ones free, and each one's travel time is added to its share of the job.
+// agents only ever go from busy to free on their own, so the
+// free agents counted here are all still free when picked.
+bool AssignToFreeAgents(CityDepartment_t *departmentData, CityEvent_t *event, uint8_t units)
+{
+    if (CountFreeAgents(departmentData) + __builtin_popcount(departmentData->heldMask) < units)
+        return false;
+
+    TickType_t now = CityTicks();
+
+    ReleaseHeldAgents(departmentData, now);
+
+    // duplicates merged into the job while it was queued
+    event->ticks += TakeMergedWork(departmentData, event, false);
+
+    for (uint8_t assigned = 0; assigned < units; assigned++)
+    {
+        uint8_t unit = PickFreeAgent(departmentData, event->location);
+        CityDepartmentAgentState_t *agentState = &(departmentData->agentStates[unit]);
+        TickType_t travel = spatial_distance(agentState->location, event->location) * TRAVEL_TICKS_PER_CELL;
+
+        spatial_index_remove(&(departmentData->freeUnits), unit);
+        departmentData->stats.trips++;
+        departmentData->stats.travelTicks += travel;
+
+        // a preemption request aimed at the agent's last job, which it
+        // finished on its own, must not cut this one short. it is cleared
+        // here rather than by the agent, so that a request made before
+        // the agent gets around to starting this job is kept.
+        if (!simulationRunning && agentState->handle != NULL)
+        {
+            ulTaskNotifyValueClear(agentState->handle, UINT32_MAX);
+            xTaskNotifyStateClear(agentState->handle);
+        }
+
+        agentState->currentEvent = *event;
+        agentState->location = event->location;
+        agentState->leadsEvent = assigned == 0;
+        departmentData->startedTicks[unit] = now;
+        departmentData->jobTicks[unit] = event->ticks + travel;
+
+        // the agent picks up its job as soon as it reads as busy
+        taskENTER_CRITICAL();
+        departmentData->busyUntilSum += now + departmentData->jobTicks[unit];
+        departmentData->busyMask |= AGENT_BIT(unit);
+        if (event->severity == MINOR && event->units <= 1)
+            departmentData->preemptibleMask |= AGENT_BIT(unit);
+        taskEXIT_CRITICAL();
+
+        if (simulationRunning) sim_start_job(departmentData, agentState);
+    }
+
+    return true;
+}
+
+// an agent rejoins the spatial index before it reads as free,
+// in one step, so the manager never sees one without the other
+void ReleaseAgent(CityDepartmentAgentState_t *agentState)
+{
+    CityDepartment_t *departmentData = agentState->department;
+
+    taskENTER_CRITICAL();
+    spatial_index_add(&(departmentData->freeUnits), agentState->unit, agentState->location);
+    departmentData->busyUntilSum -= departmentData->startedTicks[agentState->unit]
+        + departmentData->jobTicks[agentState->unit];
+    departmentData->busyMask &= ~AGENT_BIT(agentState->unit);
+    departmentData->preemptibleMask &= ~AGENT_BIT(agentState->unit);
+    taskEXIT_CRITICAL();
+}
+
+// picks the busy agent with the most remaining time on a minor job,
+// and asks it to stop. returns NULL if no minor job was found.
+CityDepartmentAgentState_t *RequestPreemption(CityDepartment_t *departmentData, TickType_t now)
+{
+    CityDepartmentAgentState_t *victim = NULL;
+    TickType_t victimRemaining = 0;
+    uint8_t candidates = departmentData->busyMask & departmentData->preemptibleMask;
+
+    while (candidates != 0)
+    {
+        uint8_t unit = __builtin_ctz(candidates);
+        TickType_t remaining = AgentRemainingTicks(departmentData, unit, now);
+
+        candidates &= candidates - 1;
+
+        if (victim == NULL || remaining > victimRemaining)
+        {
+            victim = &(departmentData->agentStates[unit]);
+            victimRemaining = remaining;
+        }
+    }
+
+    // simulated agents have no task to interrupt
+    if (victim != NULL && !simulationRunning) xTaskNotifyGive(victim->handle);
+
+    return victim;
+}
+
+// preempting only helps if the minor jobs that can be cut short free up
+// enough agents for the event to start right away, and there is room
+// to keep every one of them for resuming. otherwise a minor job would be
+// cut short for nothing, and its agent likely lent to the next one.
+bool PreemptionCovers(CityDepartment_t *departmentData, uint8_t units)
+{
+    uint8_t available = CountFreeAgents(departmentData) + __builtin_popcount(departmentData->heldMask);
+    uint8_t preemptible = __builtin_popcount(departmentData->busyMask & departmentData->preemptibleMask);
+
+    if (available >= units) return true;
+    if (available + preemptible < units) return false;
+
+    return units - available <= MAX_PREEMPTED_JOBS - departmentData->preemptedCount;
+}
+
+// interrupts a minor job, and stores what is left of it
+// for the manager to resume later. returns once the agent
+// is free, or false if no minor job was found.
+bool PreemptMinorJob(CityDepartment_t *departmentData)
+{
+    if (departmentData->preemptedCount >= MAX_PREEMPTED_JOBS) return false;
+
+    TickType_t now = CityTicks();
+    CityDepartmentAgentState_t *victim = RequestPreemption(departmentData, now);
+
+    if (victim == NULL) return false;
+
+    // simulated jobs are cut short right here
+    if (simulationRunning)
+    {
+        SuspendAgentJob(victim, now);
+    }
+    else
+    {
+        // the agent may also have finished on its own in the meantime,
+        // in which case there is nothing to resume
+        while (departmentData->busyMask & AGENT_BIT(victim->unit))
+        {
+            vTaskDelay(1);
+        }
+    }
+
+    if (victim->preempted)
+    {
+        victim->preempted = false;
+        departmentData->preemptedJobs[departmentData->preemptedCount] = victim->currentEvent;
+        AddQueuedWork(departmentData, &(victim->currentEvent));
+        departmentData->preemptedCount++;
+        departmentData->stats.preemptions++;
+    }
+
+    return true;
+}
+
+// how long until enough busy agents free up for a multi-unit event,
+// judging by the time left on their current jobs
+TickType_t GangShadowTicks(CityDepartment_t *departmentData, uint8_t units)
+{
+    TickType_t remaining[MAX_DEPARTMENT_AGENTS];
+    uint8_t busyCount = 0;
+    uint8_t busyMask = departmentData->busyMask;
+    uint8_t freeAgents = departmentData->agentCount - __builtin_popcount(busyMask);
+    TickType_t now = CityTicks();
+
+    while (busyMask != 0)
+    {
+        uint8_t unit = __builtin_ctz(busyMask);
+
+        busyMask &= busyMask - 1;
+
+        // insertion sort, agent counts are tiny
+        TickType_t ticks = AgentRemainingTicks(departmentData, unit, now);
+        uint8_t j = busyCount;
+
+        while (j > 0 && remaining[j-1] > ticks)
+        {
+            remaining[j] = remaining[j-1];
+            j--;
         }
+
+        remaining[j] = ticks;
+        busyCount++;
+    }
+
+    if (freeAgents >= units) return 0;
+    return remaining[units - freeAgents - 1];
+}
+
+// while a multi-unit event waits for enough agents, the job at the
+// head of the queue may borrow the nearest idle agent, as long as
+// it is done, travel included, by the time the event could start anyway.
+// the shadow and the borrowed job are timed from the same clock as the
+// agents count down their jobs, so the event's wait only grows if a
+// duplicate merged into one of the jobs ahead of it makes it longer.
+bool BackfillGangWait(CityDepartment_t *departmentData, uint8_t units)
+{
+    CityEvent_t candidate;
+
+    if (CountFreeAgents(departmentData) == 0) return false;
+    if (spsc_ring_count(&(departmentData->priorityRing)) > 0) return false;
+    if (!spsc_ring_peek(&(departmentData->jobRing), &candidate)) return false;
+    if (candidate.units > 1) return false;
+
+    uint8_t unit = PickFreeAgent(departmentData, candidate.location);
+    TickType_t travel = spatial_distance(departmentData->agentStates[unit].location,
+            candidate.location) * TRAVEL_TICKS_PER_CELL;
+
+    if (candidate.ticks + travel > GangShadowTicks(departmentData, units)) return false;
+
+    // the manager is the ring's only consumer,
+    // so the peeked job is still at its head
+    spsc_ring_pop(&(departmentData->jobRing), &candidate);
+    RemoveQueuedWork(departmentData, &candidate);
+    logger_log_manager_routing(departmentNames[departmentData->code], candidate.description);
+    AssignToFreeAgents(departmentData, &candidate, 1);
+    RecordAssignment(departmentData, &candidate);
+    departmentData->stats.backfilled++;
+
+    return true;
+}
+
+// the baseline to backfilling: every agent that frees up while a
+// multi-unit event waits is set aside for it, and stays idle until
+// the rest are free. held agents leave the spatial index, so nothing
+// else is handed to them, and their idle time is counted.
+void HoldFreeAgents(CityDepartment_t *departmentData)
+{
+    TickType_t now = CityTicks();
+    uint8_t allMask = (uint8_t)((1u << departmentData->agentCount) - 1);
+    uint8_t freeMask = allMask & ~(departmentData->busyMask | departmentData->heldMask);
+
+    while (freeMask != 0)
+    {
+        uint8_t unit = __builtin_ctz(freeMask);
+
+        freeMask &= freeMask - 1;
+        departmentData->startedTicks[unit] = now;
+
+        taskENTER_CRITICAL();
+        spatial_index_remove(&(departmentData->freeUnits), unit);
+        departmentData->heldMask |= AGENT_BIT(unit);
+        taskEXIT_CRITICAL();
+    }
+}
+
+void ReleaseHeldAgents(CityDepartment_t *departmentData, TickType_t now)
+{
+    uint8_t heldMask = departmentData->heldMask;
+
+    while (heldMask != 0)
+    {
+        uint8_t unit = __builtin_ctz(heldMask);
+
+        heldMask &= heldMask - 1;
+        departmentData->stats.heldTicks += now - departmentData->startedTicks[unit];
+
+        taskENTER_CRITICAL();
+        spatial_index_add(&(departmentData->freeUnits), unit, departmentData->agentStates[unit].location);
+        departmentData->heldMask &= ~AGENT_BIT(unit);
+        taskEXIT_CRITICAL();
     }
 }
 
 // the department agent waits to be assigned a task by its manager.
-// it then waits for (task) milliseconds before reporting the task complete.
+// it then waits for (task) milliseconds before reporting the task complete,
+// unless its manager preempts it, in which case it records the time left.
 void DepartmentAgentTask(void *param)
 {
     CityDepartmentAgentState_t *agentState = (CityDepartmentAgentState_t *)param;
+    CityDepartment_t *departmentData = agentState->department;
+    uint8_t unit = agentState->unit;
+    uint8_t heartbeat = monitor_register(agentState->name, 1);
 
     logger_log_unit_initialized(agentState->name);
 
@@ -495,18 +1255,106 @@ void DepartmentAgentTask(void *param)
     {
         logger_log_unit_waiting(agentState->name);
 
-        while(!agentState->busy)
+        while(!(departmentData->busyMask & AGENT_BIT(unit)))
         {
             vTaskDelay(1);
+            monitor_tick(heartbeat);
         }
 
+        monitor_beat(heartbeat, departmentData->jobTicks[unit] + MONITOR_GRACE);
+
         logger_log_unit_handling(agentState->name, agentState->currentEvent.description);
-        vTaskDelay(agentState->currentEvent.ticks);
-        agentState->busy = false;
+
+        // the job is timed from when it was assigned
+        TickType_t wait = AgentRemainingTicks(departmentData, unit, xTaskGetTickCount());
+        bool preempted = false;
+
+        // the agents stay on for whatever duplicates were merged into
+        // the job while it was under way. whichever of them is done first
+        // extends the whole job, the others included, and the lead agent
+        // closes it to merges once there is nothing more to take up
+        do
+        {
+            if (ulTaskNotifyTake(pdTRUE, wait))
+            {
+                preempted = true;
+                break;
+            }
+
+            TickType_t extension = TakeMergedWork(departmentData, &(agentState->currentEvent),
+                    agentState->leadsEvent);
+
+            if (extension > 0) ExtendJob(departmentData, &(agentState->currentEvent), extension);
+
+            wait = AgentRemainingTicks(departmentData, unit, xTaskGetTickCount());
+            if (wait > 0) monitor_beat(heartbeat, wait + MONITOR_GRACE);
+        } while (wait > 0);
+
+        if (preempted)
+        {
+            SuspendAgentJob(agentState, xTaskGetTickCount());
+            logger_log_unit_preempted(agentState->name, agentState->currentEvent.description);
+            continue;
+        }
+
+        bool leadsEvent = FinishAgentJob(agentState);
 
         logger_log_unit_finished(agentState->name, agentState->currentEvent.description);
-        eventBacklog--;
+        if (leadsEvent) eventBacklog--;
+    }
+}
+
+// keeps what is left of an interrupted job for its manager to resume.
+// the trip there is made again on resuming, so what is left of it
+// now isn't kept, or a job preempted over and over would keep growing.
+void SuspendAgentJob(CityDepartmentAgentState_t *agentState, TickType_t now)
+{
+    CityDepartment_t *departmentData = agentState->department;
+    TickType_t elapsed = now - departmentData->startedTicks[agentState->unit];
+    TickType_t jobTicks = departmentData->jobTicks[agentState->unit];
+    TickType_t remaining = elapsed < jobTicks ? jobTicks - elapsed : 1;
+
+    departmentData->stats.busyTicks += elapsed;
+    if (remaining < agentState->currentEvent.ticks) agentState->currentEvent.ticks = remaining;
+    agentState->preempted = true;
+    ReleaseAgent(agentState);
+}
+
+// every agent still busy on the event is kept on it a little longer
+void ExtendJob(CityDepartment_t *departmentData, const CityEvent_t *event, TickType_t ticks)
+{
+    taskENTER_CRITICAL();
+
+    uint8_t busyMask = departmentData->busyMask;
+
+    while (busyMask != 0)
+    {
+        uint8_t unit = __builtin_ctz(busyMask);
+
+        busyMask &= busyMask - 1;
+
+        if (departmentData->agentStates[unit].currentEvent.id != event->id) continue;
+
+        departmentData->jobTicks[unit] += ticks;
+        departmentData->busyUntilSum += ticks;
     }
+
+    taskEXIT_CRITICAL();
+}
+
+// returns whether the agent led the event, and so completed it
+bool FinishAgentJob(CityDepartmentAgentState_t *agentState)
+{
+    CityDepartment_t *departmentData = agentState->department;
+    bool leadsEvent = agentState->leadsEvent;
+
+    departmentData->stats.busyTicks += departmentData->jobTicks[agentState->unit];
+    if (leadsEvent) departmentData->stats.completed[agentState->currentEvent.severity]++;
+    ReleaseAgent(agentState);
+
+    if (leadsEvent) journal_append(JOURNAL_COMPLETED, &(agentState->currentEvent));
+
+    return leadsEvent;
 }
 
 // the logger doesn't do a lot yet,
@@ -517,14 +1365,17 @@ void LoggerTask(void *param)
     //TODO: actually implement the logger in a meaningful way
     CityData_t *cityData = (CityData_t *)param;
 
-    loggerBehavior = PRINT_LOG;
+    logger_set_behavior(PRINT_LOG);
     vTaskDelay(INITIAL_SLEEP);
 
     logger_log_logger_starting();
 
+    uint8_t heartbeat = monitor_register("Logger", LOGGER_SLEEP);
+
     for(;;)
     {
         vTaskDelay(LOGGER_SLEEP);
+        monitor_tick(heartbeat);
 
         if (loggerBehavior == PRINT_STATUS)
         {
@@ -536,22 +1387,18 @@ void LoggerTask(void *param)
 void LCDTask(void *param)
 {
     CityData_t *cityData = (CityData_t *)param;
+    uint8_t heartbeat = monitor_register("LCD", LCD_SLEEP);
     vTaskDelay(INITIAL_SLEEP);
 
     for(;;)
     {
         for (int i = 0; i < NUM_DEPARTMENTS; i++)
         {
-            char freeAgents = 0;
-
-            for (int j = 0; j < cityData->departments[i].agentCount; j++)
-            {
-                if (!cityData->departments[i].agentStates[j].busy)
-                    freeAgents++;
-            }
+            char freeAgents = CountFreeAgents(&(cityData->departments[i]));
 
             showDigit(i, '0' + freeAgents);
-            vTaskDelay(pdMS_TO_TICKS(100));
+            vTaskDelay(LCD_SLEEP);
+            monitor_tick(heartbeat);
         }
     }
 }
@@ -559,51 +1406,82 @@ void LCDTask(void *param)
 // TODO: will play audio cues from a queue
 void AudioTask(void *param)
 {
+    uint8_t heartbeat = monitor_register("Audio", 0);
     vTaskDelay(INITIAL_SLEEP);
 
     for(;;)
     {
+        TickType_t beep = pdMS_TO_TICKS(10 + 2000/(eventBacklog+1));
+        monitor_beat(heartbeat, beep + pdMS_TO_TICKS(500) + MONITOR_GRACE);
+
         pwm_set_wrap(SLICE_PWM_AUDIO, Eb4);
         pwm_set_chan_level(SLICE_PWM_AUDIO, PWM_CHAN_B, 4);
-        vTaskDelay(pdMS_TO_TICKS(10 + 2000/(eventBacklog+1)));
+        vTaskDelay(beep);
         pwm_set_chan_level(SLICE_PWM_AUDIO, PWM_CHAN_B, 0);
         vTaskDelay(pdMS_TO_TICKS(500));
     }
 }
 
-// the event generator creates a new event
+// the event generator creates new events
 // randomly from the preset event templates,
-// and adds it to the incoming event queue
+// and adds them to the incoming event queue.
+// every request (a button press, or the press command) is one event,
+// and they are served back to back for as long as the token bucket
+// allows, with a wait only as long as the next token takes otherwise
 void EventGeneratorTask(void *param)
 {
     vTaskDelay(INITIAL_SLEEP);
     logger_log_eventgen_starting();
 
-    QueueHandle_t *incomingQueue = (QueueHandle_t *)param;
-    uint32_t nextSleep;
-    uint8_t nextEventTemplate;
-    CityEvent_t *nextEvent = pvPortMalloc(sizeof(CityEvent_t));
+    CityData_t *cityData = (CityData_t *)param;
+    CityEvent_t nextEvent;
+    uint32_t pending = 0;
+    TickType_t wait = portMAX_DELAY;
+    uint8_t heartbeat = monitor_register("EventGenerator", 0);
 
     for(;;)
     {
-        logger_log_eventgen_waiting();
+        if (pending == 0) logger_log_eventgen_waiting();
 
-        gpio_put(PIN_EVENT_READY, true);
-        vTaskSuspend(NULL);
+        gpio_put(PIN_EVENT_READY, pending == 0);
+        monitor_beat(heartbeat, wait == portMAX_DELAY ? MONITOR_IDLE : wait + MONITOR_GRACE);
+        uint32_t requested = ulTaskNotifyTake(pdTRUE, wait);
+        monitor_beat(heartbeat, MONITOR_GRACE);
         gpio_put(PIN_EVENT_READY, false);
 
-        nextEventTemplate = RandomNumber()%8;
-        nextEvent->code = eventTemplates[nextEventTemplate].code;
-        nextEvent->description = eventTemplates[nextEventTemplate].description;
-        nextEvent->ticks = eventTemplates[nextEventTemplate].minTicks
-            + (RandomNumber()%(eventTemplates[nextEventTemplate].maxTicks-eventTemplates[nextEventTemplate].minTicks));
+        generatorStats.requested += requested;
+        pending += requested;
 
-        logger_log_eventgen_emitting( nextEvent->description, pdTICKS_TO_MS(nextEvent->ticks));
-        xQueueSend(*incomingQueue, nextEvent, portMAX_DELAY);
+        while (pending > 0)
+        {
+            taskENTER_CRITICAL();
+            bool allowed = ratelimit_take(&generatorLimiter, xTaskGetTickCount());
+            taskEXIT_CRITICAL();
+
+            if (!allowed) break;
+
+            uint64_t start = time_us_64();
+            GenerateTemplateEvent(RandomNumber()%NUM_EVENT_TEMPLATES, &nextEvent);
+            AdmitEvent(cityData, &(cityData->incomingAdmission), &nextEvent);
+            uint32_t overhead = (uint32_t)(time_us_64() - start);
+
+            generatorStats.emitted++;
+            generatorStats.overheadUs += overhead;
+            if (overhead > generatorStats.overheadMaxUs) generatorStats.overheadMaxUs = overhead;
+            pending--;
+
+            logger_log_eventgen_emitting(nextEvent.description, pdTICKS_TO_MS(nextEvent.ticks));
+        }
+
+        wait = portMAX_DELAY;
 
-        //nextSleep = EVENT_GENERATOR_SLEEP_MIN
-        //    + (RandomNumber()%(EVENT_GENERATOR_SLEEP_MAX-EVENT_GENERATOR_SLEEP_MIN));
-        //vTaskDelay(nextSleep);
-        vTaskDelay(pdMS_TO_TICKS(buttonCooldownMs));
+        if (pending > 0)
+        {
+            generatorStats.limited++;
+
+            taskENTER_CRITICAL();
+            wait = ratelimit_delay(&generatorLimiter, xTaskGetTickCount());
+            taskEXIT_CRITICAL();
+        }
     }
 }
@@ -0,0 +1,60 @@
+#include "ratelimit.h"
+
+static void ratelimit_refill(RateLimiter_t *limiter, TickType_t now)
+{
+    uint32_t full = limiter->burst * RATELIMIT_SCALE;
+    TickType_t elapsed = now - limiter->lastRefill;
+
+    limiter->lastRefill = now;
+
+    if (limiter->credit >= full)
+    {
+        limiter->credit = full;
+        return;
+    }
+
+    uint64_t gained = (uint64_t)elapsed * limiter->perSecond * RATELIMIT_SCALE / configTICK_RATE_HZ;
+
+    limiter->credit = gained >= full - limiter->credit ? full : limiter->credit + (uint32_t)gained;
+}
+
+void ratelimit_init(RateLimiter_t *limiter, uint32_t perSecond, uint32_t burst, TickType_t now)
+{
+    limiter->perSecond = perSecond;
+    limiter->burst = burst > 0 ? burst : 1;
+    limiter->credit = limiter->burst * RATELIMIT_SCALE;
+    limiter->lastRefill = now;
+}
+
+// the tokens already in the bucket are kept, up to the new burst size
+void ratelimit_set(RateLimiter_t *limiter, uint32_t perSecond, uint32_t burst, TickType_t now)
+{
+    ratelimit_refill(limiter, now);
+    limiter->perSecond = perSecond;
+    limiter->burst = burst > 0 ? burst : 1;
+    ratelimit_refill(limiter, now);
+}
+
+bool ratelimit_take(RateLimiter_t *limiter, TickType_t now)
+{
+    ratelimit_refill(limiter, now);
+
+    if (limiter->credit < RATELIMIT_SCALE) return false;
+
+    limiter->credit -= RATELIMIT_SCALE;
+    return true;
+}
+
+TickType_t ratelimit_delay(RateLimiter_t *limiter, TickType_t now)
+{
+    ratelimit_refill(limiter, now);
+
+    if (limiter->credit >= RATELIMIT_SCALE) return 0;
+    if (limiter->perSecond == 0) return portMAX_DELAY;
+
+    // rounded up, so the token is there when the wait is over
+    uint64_t missing = (uint64_t)(RATELIMIT_SCALE - limiter->credit) * configTICK_RATE_HZ;
+    uint64_t rate = (uint64_t)limiter->perSecond * RATELIMIT_SCALE;
+
+    return (TickType_t)((missing + rate - 1) / rate);
+}
@@ -0,0 +1,31 @@
+#ifndef RATELIMIT_H
+#define RATELIMIT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "FreeRTOS.h"
+
+// a token bucket: it fills at the sustained rate up to the burst size,
+// and every event takes one token, so a producer can go as fast as it
+// likes for a burst, and at the sustained rate for as long as it likes.
+// tokens are counted in thousandths, so that slow rates still fill
+// a little on every tick.
+#define RATELIMIT_SCALE (1000)
+
+typedef struct RateLimiter
+{
+    uint32_t perSecond;
+    uint32_t burst;
+    uint32_t credit;
+    TickType_t lastRefill;
+} RateLimiter_t;
+
+// none of these lock, the caller does if the limiter is shared.
+// a limiter starts out full, and a sustained rate of 0 stops it.
+void ratelimit_init(RateLimiter_t *limiter, uint32_t perSecond, uint32_t burst, TickType_t now);
+void ratelimit_set(RateLimiter_t *limiter, uint32_t perSecond, uint32_t burst, TickType_t now);
+bool ratelimit_take(RateLimiter_t *limiter, TickType_t now);
+// how long until the next token, 0 if there is one already
+TickType_t ratelimit_delay(RateLimiter_t *limiter, TickType_t now);
+
+#endif
@@ -0,0 +1,555 @@
+#include "sim.h"
+
+#include <string.h>
+#include "pico/stdlib.h"
+#include "pico/printf.h"
+#include "task.h"
+#include "city.h"
+#include "logging.h"
+#include "coalesce.h"
+
+volatile bool simulationRunning = false;
+TickType_t simulationTicks = 0;
+
+const char simComparisonNames[SIM_COMPARISONS][SIM_COMPARISON_NAME_LENGTH] = {"preempt", "gang", "nearest"};
+
+// what each side of a comparison is called in its report
+static const char simVariantNames[SIM_COMPARISONS][2][24] =
+{
+    {"Preemption", "No Preemption"},
+    {"Backfill", "Hold And Wait"},
+    {"Nearest Unit", "First Free"},
+};
+
+// the latest incidents reported, each kept by its template
+// and place, as a repeated report of one has both the same
+typedef struct SimIncidents
+{
+    uint8_t templates[SIM_INCIDENT_HISTORY_LENGTH];
+    uint8_t locations[SIM_INCIDENT_HISTORY_LENGTH];
+    uint8_t count;
+    uint8_t next;
+} SimIncidents_t;
+
+typedef struct SimState
+{
+    // a binary min-heap ordered by time, then by scheduling order
+    SimEvent_t queue[SIM_QUEUE_LENGTH];
+    uint8_t queueLength;
+    uint32_t nextSerial;
+    // the serial of each agent's scheduled completion, so the
+    // completion of a job that was preempted can be told apart
+    uint32_t jobSerials[NUM_DEPARTMENTS][MAX_DEPARTMENT_AGENTS];
+    // the job each manager is gathering agents for, if any,
+    // and whether it is one resuming after it was preempted
+    bool waiting[NUM_DEPARTMENTS];
+    bool resumed[NUM_DEPARTMENTS];
+    CityEvent_t waitingJobs[NUM_DEPARTMENTS];
+    uint32_t random;
+    // the simulated dispatcher's own merging, and its incidents
+    CoalesceTable_t coalesce;
+    SimIncidents_t incidents;
+    uint16_t nextId;
+    // the expected wait of each event, as estimated when it was routed
+    uint64_t expectedWaitTicks[NUM_DEPARTMENTS];
+    uint32_t routed[NUM_DEPARTMENTS];
+    TickType_t finalWaitTicks[NUM_DEPARTMENTS];
+    uint32_t arrivals;
+    uint32_t steps;
+    uint64_t elapsedUs;
+    CityData_t city;
+} SimState_t;
+
+static SimState_t *simState = NULL;
+
+// xorshift32, which never leaves a nonzero state
+uint32_t sim_random(void)
+{
+    uint32_t x = simState->random;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    simState->random = x;
+
+    return x;
+}
+
+static bool sim_before(const SimEvent_t *a, const SimEvent_t *b)
+{
+    if (a->at != b->at) return a->at < b->at;
+    return a->serial < b->serial;
+}
+
+static void sim_sift_up(uint8_t index)
+{
+    SimEvent_t *queue = simState->queue;
+
+    while (index > 0)
+    {
+        uint8_t parent = (index - 1) / 2;
+        if (!sim_before(&queue[index], &queue[parent])) break;
+
+        SimEvent_t swap = queue[parent];
+        queue[parent] = queue[index];
+        queue[index] = swap;
+        index = parent;
+    }
+}
+
+static void sim_sift_down(uint8_t index)
+{
+    SimEvent_t *queue = simState->queue;
+
+    for (;;)
+    {
+        uint8_t first = index;
+        uint8_t left = 2 * index + 1;
+        uint8_t right = left + 1;
+
+        if (left < simState->queueLength && sim_before(&queue[left], &queue[first])) first = left;
+        if (right < simState->queueLength && sim_before(&queue[right], &queue[first])) first = right;
+        if (first == index) break;
+
+        SimEvent_t swap = queue[first];
+        queue[first] = queue[index];
+        queue[index] = swap;
+        index = first;
+    }
+}
+
+// a completion is stale once its agent was preempted,
+// whether or not the agent has been given another job since
+static bool sim_is_stale(const SimEvent_t *event)
+{
+    if (event->kind != SIM_COMPLETION) return false;
+
+    return simState->jobSerials[event->department][event->unit] != event->serial
+        || !(simState->city.departments[event->department].busyMask & AGENT_BIT(event->unit));
+}
+
+static void sim_compact(void)
+{
+    uint8_t kept = 0;
+
+    for (uint8_t i = 0; i < simState->queueLength; i++)
+    {
+        if (!sim_is_stale(&simState->queue[i])) simState->queue[kept++] = simState->queue[i];
+    }
+
+    simState->queueLength = kept;
+
+    for (int i = kept / 2 - 1; i >= 0; i--)
+    {
+        sim_sift_down(i);
+    }
+}
+
+static uint32_t sim_push(TickType_t at, SimEventKind_t kind, uint8_t department, uint8_t unit)
+{
+    // there is at most one arrival and one live completion per agent
+    if (simState->queueLength == SIM_QUEUE_LENGTH) sim_compact();
+
+    SimEvent_t *event = &(simState->queue[simState->queueLength]);
+    uint32_t serial = ++(simState->nextSerial);
+
+    event->at = at;
+    event->serial = serial;
+    event->kind = kind;
+    event->department = department;
+    event->unit = unit;
+
+    sim_sift_up(simState->queueLength++);
+
+    return serial;
+}
+
+static bool sim_pop(SimEvent_t *event)
+{
+    if (simState->queueLength == 0) return false;
+
+    *event = simState->queue[0];
+    simState->queue[0] = simState->queue[--(simState->queueLength)];
+    sim_sift_down(0);
+
+    return true;
+}
+
+static void sim_schedule_arrival(uint32_t meanIntervalMs)
+{
+    TickType_t interval = pdMS_TO_TICKS(meanIntervalMs / 2 + RandomNumber() % (meanIntervalMs + 1));
+
+    sim_push(simulationTicks + (interval > 0 ? interval : 1), SIM_ARRIVAL, 0, 0);
+}
+
+// also called again for a job that merged duplicates were added to
+void sim_start_job(CityDepartment_t *departmentData, CityDepartmentAgentState_t *agentState)
+{
+    simState->jobSerials[departmentData->code][agentState->unit] = sim_push(
+            departmentData->startedTicks[agentState->unit] + departmentData->jobTicks[agentState->unit],
+            SIM_COMPLETION, departmentData->code, agentState->unit);
+}
+
+// runs the manager's loop until it has to wait,
+// either for a job to arrive or for agents to free up
+static void sim_run_manager(CityDepartment_t *departmentData)
+{
+    bool *waiting = &(simState->waiting[departmentData->code]);
+    bool *resumed = &(simState->resumed[departmentData->code]);
+    CityEvent_t *job = &(simState->waitingJobs[departmentData->code]);
+
+    for (;;)
+    {
+        if (!*waiting)
+        {
+            *resumed = TakeResumedJob(departmentData, job);
+            if (!*resumed && !TakeNextJob(departmentData, job)) return;
+        }
+
+        *waiting = !DispatchJob(departmentData, job, JobUnits(departmentData, job));
+        if (*waiting) return;
+
+        if (!*resumed) RecordAssignment(departmentData, job);
+    }
+}
+
+// either a new incident, which is kept with the latest ones,
+// or another report of one of them, at a fresh duration
+static void sim_generate_event(CityEvent_t *event)
+{
+    SimIncidents_t *incidents = &(simState->incidents);
+
+    if (incidents->count > 0 && RandomNumber() % 100 < SIM_REPEAT_REPORT_PERCENT)
+    {
+        uint8_t reported = RandomNumber() % incidents->count;
+
+        GenerateTemplateEvent(incidents->templates[reported], event);
+        event->location = incidents->locations[reported];
+        return;
+    }
+
+    uint8_t templateIndex = RandomNumber() % NUM_EVENT_TEMPLATES;
+
+    GenerateTemplateEvent(templateIndex, event);
+    incidents->templates[incidents->next] = templateIndex;
+    incidents->locations[incidents->next] = event->location;
+    incidents->next = (incidents->next + 1) % SIM_INCIDENT_HISTORY_LENGTH;
+    if (incidents->count < SIM_INCIDENT_HISTORY_LENGTH) incidents->count++;
+}
+
+static void sim_step(const SimEvent_t *step, uint32_t meanIntervalMs)
+{
+    CityEvent_t event;
+
+    simulationTicks = step->at;
+
+    // the same steps as the central dispatcher's
+    if (step->kind == SIM_ARRIVAL)
+    {
+        sim_generate_event(&event);
+        event.id = simState->nextId++;
+        simState->arrivals++;
+        simState->city.incomingAdmission.accepted++;
+        sim_schedule_arrival(meanIntervalMs);
+
+        if (MergeEvent(&(simState->city), &event)) return;
+
+        TickType_t expectedWait = ChooseDepartment(&(simState->city), &event);
+
+        simState->expectedWaitTicks[event.code] += expectedWait;
+        simState->routed[event.code]++;
+
+        if (eventCoalescing) coalesce_record(&event);
+        if (RouteEvent(&(simState->city), &event) == eADMIT_REJECTED)
+            DropMergedWork(&(simState->city.departments[event.code]), &event);
+        sim_run_manager(&(simState->city.departments[event.code]));
+        return;
+    }
+
+    if (sim_is_stale(step)) return;
+
+    CityDepartment_t *departmentData = &(simState->city.departments[step->department]);
+    CityDepartmentAgentState_t *agentState = &(departmentData->agentStates[step->unit]);
+
+    // the same steps as the agent's once its wait is over
+    TickType_t extension = TakeMergedWork(departmentData, &(agentState->currentEvent),
+            agentState->leadsEvent);
+
+    if (extension > 0) ExtendJob(departmentData, &(agentState->currentEvent), extension);
+
+    if (AgentRemainingTicks(departmentData, step->unit, simulationTicks) > 0)
+    {
+        sim_start_job(departmentData, agentState);
+        return;
+    }
+
+    simState->jobSerials[step->department][step->unit] = 0;
+    FinishAgentJob(agentState);
+    sim_run_manager(departmentData);
+}
+
+static void sim_print_report(uint32_t hours, uint32_t meanIntervalMs)
+{
+    TickType_t end = simulationTicks;
+
+    printf("\n~~~~ SIMULATION (%luh, mean interval %lums) ~~~~\n",
+            (unsigned long)hours, (unsigned long)meanIntervalMs);
+    printf("~~ %lu events in %lu steps, run in %lums\n",
+            (unsigned long)simState->arrivals, (unsigned long)simState->steps,
+            (unsigned long)(simState->elapsedUs / 1000));
+    coalesce_print_stats(&(simState->coalesce));
+
+    for (int i = 0; i < NUM_DEPARTMENTS; i++)
+    {
+        CityDepartment_t *departmentData = &(simState->city.departments[i]);
+        CityDepartmentStats_t *stats = &(departmentData->stats);
+        uint32_t completed = stats->completed[MINOR] + stats->completed[MAJOR];
+
+        printf("~ %s Department ~\n", departmentNames[i]);
+        admission_print("Job", &(departmentData->jobAdmission));
+        printf("~~ Mean Response: Minor %lums, Major %lums, Mean Travel: %lums\n",
+                (unsigned long)MeanResponseMs(stats, MINOR),
+                (unsigned long)MeanResponseMs(stats, MAJOR),
+                (unsigned long)MeanTravelMs(stats));
+        printf("~~ Completed: Minor %lu, Major %lu, Unfinished: %lu, Preemptions: %lu, Backfilled: %lu\n",
+                (unsigned long)stats->completed[MINOR], (unsigned long)stats->completed[MAJOR],
+                (unsigned long)(departmentData->jobAdmission.accepted
+                    - departmentData->jobAdmission.evicted - completed),
+                (unsigned long)stats->preemptions, (unsigned long)stats->backfilled);
+        printf("~~ Expected Wait: Mean At Routing %lums, At The End %lums\n",
+                (unsigned long)(simState->routed[i] == 0 ? 0
+                    : pdTICKS_TO_MS(simState->expectedWaitTicks[i] / simState->routed[i])),
+                (unsigned long)pdTICKS_TO_MS(simState->finalWaitTicks[i]));
+        printf("~~ Utilization: %lu%%, Held Idle: %lu%%, Taken Over: %lu\n",
+                (unsigned long)(end == 0 ? 0 : 100ULL * stats->busyTicks
+                    / ((uint64_t)departmentData->agentCount * end)),
+                (unsigned long)(end == 0 ? 0 : 100ULL * stats->heldTicks
+                    / ((uint64_t)departmentData->agentCount * end)),
+                (unsigned long)stats->takenOver);
+    }
+
+    printf("~~~~~~~~~~~~~~~~~~~~~\n");
+}
+
+static void sim_print_summary_line(const char *name, CityDepartmentStats_t *stats, uint32_t agentCount)
+{
+    TickType_t end = simulationTicks;
+
+    printf("~~ %-9s Response Minor %6lums, Major %6lums, Travel %5lums, Completed Minor %6lu, Major %6lu, Utilization %3lu%%, Held %3lu%%\n",
+            name, (unsigned long)MeanResponseMs(stats, MINOR), (unsigned long)MeanResponseMs(stats, MAJOR),
+            (unsigned long)MeanTravelMs(stats),
+            (unsigned long)stats->completed[MINOR], (unsigned long)stats->completed[MAJOR],
+            (unsigned long)(end == 0 ? 0 : 100ULL * stats->busyTicks / ((uint64_t)agentCount * end)),
+            (unsigned long)(end == 0 ? 0 : 100ULL * stats->heldTicks / ((uint64_t)agentCount * end)));
+}
+
+// one side of a comparison, each department and the city as a whole
+static void sim_print_summary(const char *variantName)
+{
+    CityDepartmentStats_t total = {0};
+    uint32_t agentCount = 0;
+
+    printf("~ %s ~\n", variantName);
+
+    for (int i = 0; i < NUM_DEPARTMENTS; i++)
+    {
+        CityDepartment_t *departmentData = &(simState->city.departments[i]);
+        CityDepartmentStats_t *stats = &(departmentData->stats);
+
+        sim_print_summary_line(departmentNames[i], stats, departmentData->agentCount);
+
+        for (int severity = MINOR; severity <= MAJOR; severity++)
+        {
+            total.assigned[severity] += stats->assigned[severity];
+            total.responseTicks[severity] += stats->responseTicks[severity];
+            total.completed[severity] += stats->completed[severity];
+        }
+
+        total.busyTicks += stats->busyTicks;
+        total.heldTicks += stats->heldTicks;
+        total.trips += stats->trips;
+        total.travelTicks += stats->travelTicks;
+        agentCount += departmentData->agentCount;
+    }
+
+    sim_print_summary_line("City", &total, agentCount);
+}
+
+// a comparison changes one setting of every department,
+// the first variant being the one the city normally runs with
+static void sim_configure(CityDepartment_t *departmentData, int comparison, uint8_t variant)
+{
+    switch (comparison)
+    {
+        case SIM_COMPARE_PREEMPTION:
+            departmentData->preemptive = variant == 0;
+            break;
+        case SIM_COMPARE_GANG_DISPATCH:
+            departmentData->gangPolicy = variant == 0 ? GANG_BACKFILL : GANG_HOLD_AND_WAIT;
+            break;
+        case SIM_COMPARE_NEAREST_UNIT:
+            departmentData->nearestUnit = variant == 0;
+            break;
+        default:
+            break;
+    }
+}
+
+static void sim_free(void)
+{
+    for (int i = 0; i < NUM_DEPARTMENTS; i++)
+    {
+        FreeDepartment(&(simState->city.departments[i]));
+    }
+
+    vPortFree(simState);
+    simState = NULL;
+}
+
+// the live tasks are held with the scheduler suspended while the
+// simulation runs, so it has the city logic to itself, but only for
+// a slice of steps at a time, so that the monitor, the watchdog and
+// everything else still get to run in between.
+// it works on its own departments, and leaves the live ones,
+// the event backlog and the logger as it found them after each slice.
+// the departments are set up in the first slice, so that even
+// the agents' starting places come from the seeded generator.
+static void sim_begin_slice(uint32_t *backlog)
+{
+    vTaskSuspendAll();
+
+    *backlog = eventBacklog;
+    loggerActiveMask = 0;
+    coalesce_use(&(simState->coalesce));
+    simulationRunning = true;
+}
+
+static void sim_end_slice(uint32_t backlog)
+{
+    simulationRunning = false;
+    coalesce_use(&coalesceTable);
+    eventBacklog = backlog;
+    logger_set_behavior(loggerBehavior);
+
+    xTaskResumeAll();
+}
+
+static bool sim_run_once(uint32_t hours, uint32_t meanIntervalMs, uint32_t seed,
+        int comparison, uint8_t variant)
+{
+    SimEvent_t step;
+    uint32_t backlog;
+    TickType_t end = pdMS_TO_TICKS((uint64_t)hours * 60 * 60 * 1000);
+    uint64_t start;
+    bool allocated = true;
+    bool running = true;
+
+    simState = pvPortMalloc(sizeof(SimState_t));
+    if (simState == NULL)
+    {
+        printf("~~ Simulation Out Of Memory, %lu Bytes Free\n", (unsigned long)xPortGetFreeHeapSize());
+        return false;
+    }
+    memset(simState, 0, sizeof(SimState_t));
+
+    simState->random = seed != 0 ? seed : 1;
+    admission_init(&(simState->city.incomingAdmission), ADMIT_REJECT_NEW);
+
+    sim_begin_slice(&backlog);
+    simulationTicks = 0;
+
+    for (int i = 0; i < NUM_DEPARTMENTS; i++)
+    {
+        allocated = InitializeDepartment(&(simState->city.departments[i]), i,
+                SIM_DEPARTMENT_QUEUE_LENGTH) && allocated;
+        sim_configure(&(simState->city.departments[i]), comparison, variant);
+
+        // nothing else runs to drain a full ring,
+        // so there is no point in blocking on one
+        if (simState->city.departments[i].jobAdmission.policy == ADMIT_BLOCK)
+            simState->city.departments[i].jobAdmission.policy = ADMIT_REJECT_NEW;
+    }
+
+    if (!allocated)
+    {
+        sim_end_slice(backlog);
+        sim_free();
+        printf("~~ Simulation Out Of Memory, %lu Bytes Free\n", (unsigned long)xPortGetFreeHeapSize());
+        return false;
+    }
+
+    sim_schedule_arrival(meanIntervalMs);
+
+    for (;;)
+    {
+        start = time_us_64();
+
+        for (uint32_t i = 0; running && i < SIM_SLICE_STEPS; i++)
+        {
+            running = sim_pop(&step) && step.at <= end;
+
+            if (running)
+            {
+                simState->steps++;
+                sim_step(&step, meanIntervalMs);
+            }
+        }
+
+        // read off the simulated clock, so before the slice ends
+        for (int i = 0; i < NUM_DEPARTMENTS && !running; i++)
+        {
+            simState->finalWaitTicks[i] = ExpectedWaitTicks(&(simState->city.departments[i]), 1);
+        }
+
+        simState->elapsedUs += time_us_64() - start;
+        sim_end_slice(backlog);
+
+        if (!running) break;
+
+        vTaskDelay(1);
+        sim_begin_slice(&backlog);
+    }
+
+    simulationTicks = end;
+
+    return true;
+}
+
+static void sim_limit(uint32_t *hours, uint32_t *meanIntervalMs)
+{
+    if (*hours == 0 || *hours > SIM_MAX_HOURS) *hours = SIM_DEFAULT_HOURS;
+    if (*meanIntervalMs == 0) *meanIntervalMs = SIM_DEFAULT_INTERVAL_MS;
+}
+
+void sim_run(uint32_t hours, uint32_t meanIntervalMs)
+{
+    sim_limit(&hours, &meanIntervalMs);
+
+    if (!sim_run_once(hours, meanIntervalMs, RandomNumber(), -1, 0)) return;
+
+    sim_print_report(hours, meanIntervalMs);
+    sim_free();
+}
+
+// both variants are run on the same workload, arrivals, templates,
+// durations and places alike, drawn from the same seed
+void sim_compare(int comparison, uint32_t hours, uint32_t meanIntervalMs)
+{
+    uint32_t seed = RandomNumber();
+
+    if (comparison < 0 || comparison >= SIM_COMPARISONS) return;
+    sim_limit(&hours, &meanIntervalMs);
+
+    printf("\n~~~~ SIMULATION COMPARISON (%luh, mean interval %lums) ~~~~\n",
+            (unsigned long)hours, (unsigned long)meanIntervalMs);
+
+    for (uint8_t variant = 0; variant < 2; variant++)
+    {
+        if (!sim_run_once(hours, meanIntervalMs, seed, comparison, variant)) return;
+
+        sim_print_summary(simVariantNames[comparison][variant]);
+        sim_free();
+    }
+
+    printf("~~~~~~~~~~~~~~~~~~~~~\n");
+}
@@ -0,0 +1,72 @@
+#ifndef SIM_H
+#define SIM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "FreeRTOS.h"
+#include "city.h"
+
+// the simulation runs the city's routing and assignment logic
+// in virtual time, jumping from one timed event to the next
+// instead of sleeping, so hours of load take seconds to run
+#define SIM_DEFAULT_HOURS (24)
+#define SIM_MAX_HOURS (24 * 7)
+#define SIM_DEFAULT_INTERVAL_MS (4000)
+// pending arrivals and completions, stale completions of
+// preempted jobs included, are compacted away if it fills up
+#define SIM_QUEUE_LENGTH (64)
+// the simulated departments are allocated alongside the live ones,
+// so their job rings are kept at half the live ones' 128 events.
+// only a department falling hopelessly behind fills them.
+#define SIM_DEPARTMENT_QUEUE_LENGTH (64)
+// the live tasks get to run between slices of this many steps
+#define SIM_SLICE_STEPS (500)
+// how often a simulated arrival reports one of the latest incidents
+// again, from the same place, as several callers might. the live
+// generator only ever reports new ones.
+#define SIM_REPEAT_REPORT_PERCENT (20)
+#define SIM_INCIDENT_HISTORY_LENGTH (4)
+
+// the settings a comparison runs the same workload under
+#define SIM_COMPARISONS (3)
+#define SIM_COMPARISON_NAME_LENGTH (10)
+#define SIM_COMPARE_PREEMPTION (0)
+#define SIM_COMPARE_GANG_DISPATCH (1)
+#define SIM_COMPARE_NEAREST_UNIT (2)
+
+typedef enum SimEventKind
+{
+    SIM_ARRIVAL = 0,
+    SIM_COMPLETION = 1
+} SimEventKind_t;
+
+typedef struct SimEvent
+{
+    TickType_t at;
+    uint32_t serial;
+    uint8_t kind;       // SimEventKind_t
+    uint8_t department;
+    uint8_t unit;
+} SimEvent_t;
+
+// while set, CityTicks() reads the simulated clock
+extern volatile bool simulationRunning;
+extern TickType_t simulationTicks;
+
+extern const char simComparisonNames[SIM_COMPARISONS][SIM_COMPARISON_NAME_LENGTH];
+
+// events arrive uniformly between half and one and a half
+// of the mean interval, from random templates, now and then
+// reporting a recent incident again
+void sim_run(uint32_t hours, uint32_t meanIntervalMs);
+// runs one workload twice, once under each variant of a setting,
+// and reports the two side by side
+void sim_compare(int comparison, uint32_t hours, uint32_t meanIntervalMs);
+// stands in for RandomNumber() while simulating
+uint32_t sim_random(void);
+
+// called by the manager's assignment step for each agent it hands
+// a job to while simulating, in place of the agent's own task
+void sim_start_job(CityDepartment_t *departmentData, CityDepartmentAgentState_t *agentState);
+
+#endif
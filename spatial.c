@@ -0,0 +1,103 @@
+#include "spatial.h"
+
+#include <stdlib.h>
+#include "FreeRTOS.h"
+#include "task.h"
+#include "city.h"
+
+uint8_t spatial_distance(uint8_t from, uint8_t to)
+{
+    return abs(LOCATION_X(from) - LOCATION_X(to)) + abs(LOCATION_Y(from) - LOCATION_Y(to));
+}
+
+uint8_t spatial_random_location(void)
+{
+    uint32_t random = RandomNumber();
+    return LOCATION(random % CITY_GRID_SIZE, (random >> 8) % CITY_GRID_SIZE);
+}
+
+void spatial_index_init(SpatialIndex_t *index)
+{
+    for (int x = 0; x < SPATIAL_BUCKETS_PER_SIDE; x++)
+    {
+        for (int y = 0; y < SPATIAL_BUCKETS_PER_SIDE; y++)
+        {
+            index->freeUnits[x][y] = 0;
+        }
+    }
+}
+
+// units free themselves from their own tasks, so bucket updates
+// are read-modify-write sections guarded against each other.
+// lookups read the buckets without guarding, so a caller must
+// still check a unit it found is free before assigning it.
+void spatial_index_add(SpatialIndex_t *index, uint8_t unit, uint8_t location)
+{
+    uint8_t x = LOCATION_X(location) >> SPATIAL_BUCKET_SHIFT;
+    uint8_t y = LOCATION_Y(location) >> SPATIAL_BUCKET_SHIFT;
+
+    taskENTER_CRITICAL();
+    index->locations[unit] = location;
+    index->freeUnits[x][y] |= 1UL << unit;
+    taskEXIT_CRITICAL();
+}
+
+void spatial_index_remove(SpatialIndex_t *index, uint8_t unit)
+{
+    taskENTER_CRITICAL();
+    uint8_t location = index->locations[unit];
+    index->freeUnits[LOCATION_X(location) >> SPATIAL_BUCKET_SHIFT]
+        [LOCATION_Y(location) >> SPATIAL_BUCKET_SHIFT] &= ~(1UL << unit);
+    taskEXIT_CRITICAL();
+}
+
+static void spatial_index_scan_bucket(SpatialIndex_t *index, int x, int y, uint8_t location,
+        int *nearest, uint8_t *nearestDistance)
+{
+    if (x < 0 || y < 0 || x >= SPATIAL_BUCKETS_PER_SIDE || y >= SPATIAL_BUCKETS_PER_SIDE) return;
+
+    uint32_t units = index->freeUnits[x][y];
+
+    while (units != 0)
+    {
+        int unit = __builtin_ctz(units);
+        uint8_t distance = spatial_distance(location, index->locations[unit]);
+        units &= units - 1;
+
+        if (distance < *nearestDistance)
+        {
+            *nearest = unit;
+            *nearestDistance = distance;
+        }
+    }
+}
+
+// searches the buckets in growing square rings around the location,
+// and stops once no unit in the next ring could possibly be nearer.
+// returns the nearest free unit, or -1 if there are none.
+int spatial_index_nearest(SpatialIndex_t *index, uint8_t location)
+{
+    int centerX = LOCATION_X(location) >> SPATIAL_BUCKET_SHIFT;
+    int centerY = LOCATION_Y(location) >> SPATIAL_BUCKET_SHIFT;
+    int nearest = -1;
+    uint8_t nearestDistance = UINT8_MAX;
+
+    for (int ring = 0; ring < SPATIAL_BUCKETS_PER_SIDE; ring++)
+    {
+        // a unit in a bucket this many rings out is at least this far away
+        if (ring > 0 && nearestDistance <= (ring - 1) * SPATIAL_BUCKET_CELLS + 1) break;
+
+        for (int x = centerX - ring; x <= centerX + ring; x++)
+        {
+            bool edge = x == centerX - ring || x == centerX + ring;
+            int step = edge || ring == 0 ? 1 : 2 * ring;
+
+            for (int y = centerY - ring; y <= centerY + ring; y += step)
+            {
+                spatial_index_scan_bucket(index, x, y, location, &nearest, &nearestDistance);
+            }
+        }
+    }
+
+    return nearest;
+}
@@ -0,0 +1,38 @@
+#ifndef SPATIAL_H
+#define SPATIAL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// the city is a square grid, and a location packs
+// its x coordinate in the high nibble and y in the low one
+#define CITY_GRID_SIZE (16)
+#define LOCATION(x, y) ((uint8_t)(((x) << 4) | ((y) & 0x0F)))
+#define LOCATION_X(location) ((location) >> 4)
+#define LOCATION_Y(location) ((location) & 0x0F)
+
+// travel time is added to the handling time of every job
+#define TRAVEL_TICKS_PER_CELL (pdMS_TO_TICKS(250))
+
+// free units are bucketed by location into a coarse uniform grid,
+// each bucket being a bitmask over the department's units
+#define SPATIAL_BUCKET_SHIFT (2)
+#define SPATIAL_BUCKET_CELLS (1 << SPATIAL_BUCKET_SHIFT)
+#define SPATIAL_BUCKETS_PER_SIDE (CITY_GRID_SIZE / SPATIAL_BUCKET_CELLS)
+#define SPATIAL_MAX_UNITS (32)
+
+typedef struct SpatialIndex
+{
+    uint32_t freeUnits[SPATIAL_BUCKETS_PER_SIDE][SPATIAL_BUCKETS_PER_SIDE];
+    uint8_t locations[SPATIAL_MAX_UNITS];
+} SpatialIndex_t;
+
+uint8_t spatial_distance(uint8_t from, uint8_t to);
+uint8_t spatial_random_location(void);
+
+void spatial_index_init(SpatialIndex_t *index);
+void spatial_index_add(SpatialIndex_t *index, uint8_t unit, uint8_t location);
+void spatial_index_remove(SpatialIndex_t *index, uint8_t unit);
+int spatial_index_nearest(SpatialIndex_t *index, uint8_t location);
+
+#endif
@@ -0,0 +1,132 @@
+#include "spsc_ring.h"
+
+#include <stdatomic.h>
+#include "city.h"
+
+// orders slot accesses against the index that publishes them.
+// the producer fills a slot before releasing head, and the consumer
+// reads a slot after acquiring head, and likewise for tail
+#define SPSC_RING_ACQUIRE() atomic_thread_fence(memory_order_acquire)
+#define SPSC_RING_RELEASE() atomic_thread_fence(memory_order_release)
+
+bool spsc_ring_init(SpscRing_t *ring, uint32_t capacity)
+{
+    ring->slots = pvPortMalloc(sizeof(CityEvent_t) * capacity);
+    ring->mask = capacity - 1;
+    ring->head = 0;
+    ring->tail = 0;
+    ring->minorPushed = 0;
+    ring->minorTaken = 0;
+    ring->consumer = NULL;
+
+    return ring->slots != NULL;
+}
+
+void spsc_ring_free(SpscRing_t *ring)
+{
+    vPortFree(ring->slots);
+    ring->slots = NULL;
+}
+
+void spsc_ring_set_consumer(SpscRing_t *ring, TaskHandle_t consumer)
+{
+    ring->consumer = consumer;
+}
+
+uint32_t spsc_ring_space(SpscRing_t *ring)
+{
+    return ring->mask + 1 - (ring->head - ring->tail);
+}
+
+uint32_t spsc_ring_count(SpscRing_t *ring)
+{
+    return ring->head - ring->tail;
+}
+
+// the consumer counts a minor event taken before it releases the slot
+uint32_t spsc_ring_minor_count(SpscRing_t *ring)
+{
+    return ring->minorPushed - ring->minorTaken;
+}
+
+bool spsc_ring_push(SpscRing_t *ring, const CityEvent_t *event)
+{
+    uint32_t head = ring->head;
+    uint32_t tail = ring->tail;
+
+    if (head - tail > ring->mask) return false;
+
+    SPSC_RING_ACQUIRE();
+    ring->slots[head & ring->mask] = *event;
+    if (event->severity == MINOR) ring->minorPushed++;
+    SPSC_RING_RELEASE();
+    ring->head = head + 1;
+
+    // tail is read again after publishing, so a consumer that
+    // drained the ring and went to sleep in between is never missed
+    atomic_thread_fence(memory_order_seq_cst);
+
+    if (ring->tail == head && ring->consumer != NULL)
+    {
+        xTaskNotifyGiveIndexed(ring->consumer, SPSC_RING_NOTIFY_INDEX);
+    }
+
+    return true;
+}
+
+bool spsc_ring_peek(SpscRing_t *ring, CityEvent_t *event)
+{
+    uint32_t tail = ring->tail;
+
+    if (ring->head == tail) return false;
+
+    SPSC_RING_ACQUIRE();
+    *event = ring->slots[tail & ring->mask];
+
+    return true;
+}
+
+bool spsc_ring_pop(SpscRing_t *ring, CityEvent_t *event)
+{
+    if (!spsc_ring_peek(ring, event)) return false;
+
+    if (event->severity == MINOR) ring->minorTaken++;
+    SPSC_RING_RELEASE();
+    ring->tail = ring->tail + 1;
+
+    // pairs with the producer's fence, so that a consumer about to
+    // sleep on an empty ring sees any head published meanwhile
+    atomic_thread_fence(memory_order_seq_cst);
+
+    return true;
+}
+
+// the slots between tail and head belong to the consumer until it
+// advances tail, so it may reorder them without the producer noticing.
+// the events older than the evicted one slide up by a slot.
+bool spsc_ring_remove_oldest_minor(SpscRing_t *ring, CityEvent_t *evicted)
+{
+    uint32_t tail = ring->tail;
+    uint32_t head = ring->head;
+
+    SPSC_RING_ACQUIRE();
+
+    for (uint32_t i = tail; i != head; i++)
+    {
+        if (ring->slots[i & ring->mask].severity != MINOR) continue;
+
+        *evicted = ring->slots[i & ring->mask];
+
+        for (uint32_t j = i; j != tail; j--)
+        {
+            ring->slots[j & ring->mask] = ring->slots[(j - 1) & ring->mask];
+        }
+
+        ring->minorTaken++;
+        SPSC_RING_RELEASE();
+        ring->tail = tail + 1;
+        return true;
+    }
+
+    return false;
+}
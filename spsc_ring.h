@@ -0,0 +1,51 @@
+#ifndef SPSC_RING_H
+#define SPSC_RING_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "FreeRTOS.h"
+#include "task.h"
+
+// the task notification slot a ring's consumer sleeps on,
+// kept apart from the default slot used for preemption
+#define SPSC_RING_NOTIFY_INDEX (1)
+
+struct CityEvent;
+
+// a single-producer, single-consumer ring of events.
+// head is only ever written by the producer and tail by the consumer,
+// both run freely and are masked into the slot array, so no locking is
+// needed beyond ordering the slot accesses against the index updates.
+// the consumer is only notified when the ring goes from empty to non-empty.
+// minor events are counted the same way, pushed by the producer and taken
+// by the consumer, so the producer can tell whether any are still queued.
+typedef struct SpscRing
+{
+    struct CityEvent *slots;
+    uint32_t mask;
+    volatile uint32_t head;
+    volatile uint32_t tail;
+    volatile uint32_t minorPushed;
+    volatile uint32_t minorTaken;
+    TaskHandle_t consumer;
+} SpscRing_t;
+
+// capacity must be a power of two. returns false if the slots
+// couldn't be allocated, and the ring can then only be freed
+bool spsc_ring_init(SpscRing_t *ring, uint32_t capacity);
+void spsc_ring_free(SpscRing_t *ring);
+void spsc_ring_set_consumer(SpscRing_t *ring, TaskHandle_t consumer);
+
+// producer side
+bool spsc_ring_push(SpscRing_t *ring, const struct CityEvent *event);
+uint32_t spsc_ring_space(SpscRing_t *ring);
+// never fewer than are queued, it may count one the consumer is taking
+uint32_t spsc_ring_minor_count(SpscRing_t *ring);
+
+// consumer side
+bool spsc_ring_pop(SpscRing_t *ring, struct CityEvent *event);
+bool spsc_ring_peek(SpscRing_t *ring, struct CityEvent *event);
+bool spsc_ring_remove_oldest_minor(SpscRing_t *ring, struct CityEvent *evicted);
+uint32_t spsc_ring_count(SpscRing_t *ring);
+
+#endif
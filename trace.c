@@ -0,0 +1,192 @@
+#include "trace.h"
+
+#include <stdio.h>
+#include "pico/stdlib.h"
+#include "pico/printf.h"
+#include "task.h"
+#include "city.h"
+#include "logging.h"
+#include "sim.h"
+
+// the ring is indexed by the running count of records,
+// so the dump can tell how much of it has been overwritten
+static TraceEntry_t traceBuffer[TRACE_BUFFER_RECORDS];
+static uint32_t traceCount = 0;
+static uint8_t traceCurrentTask = 0;
+static volatile bool tracePaused = false;
+
+// must be called with interrupts disabled,
+// which the kernel hooks already are
+void trace_record(uint8_t type, uint8_t object)
+{
+    if (tracePaused) return;
+
+    TraceEntry_t *entry = &(traceBuffer[traceCount++ % TRACE_BUFFER_RECORDS]);
+
+    entry->timestamp = time_us_32();
+    entry->type = type;
+    entry->task = traceCurrentTask;
+    entry->object = object;
+}
+
+void trace_task_switched_in(uint8_t task)
+{
+    traceCurrentTask = task;
+    trace_record(TRACE_TASK_SWITCHED_IN, task);
+}
+
+// the simulation runs with the scheduler suspended,
+// and would only wash out the live timeline
+void trace_mark(TraceRecordType_t type, uint8_t object)
+{
+    if (simulationRunning) return;
+
+    taskENTER_CRITICAL();
+    trace_record(type, object);
+    taskEXIT_CRITICAL();
+}
+
+void trace_clear(void)
+{
+    taskENTER_CRITICAL();
+    traceCount = 0;
+    taskEXIT_CRITICAL();
+}
+
+void trace_print_stats(void)
+{
+    uint32_t count = traceCount;
+
+    printf("~~ Trace: Records %lu, Buffered %lu of %lu\n", (unsigned long)count,
+            (unsigned long)(count < TRACE_BUFFER_RECORDS ? count : TRACE_BUFFER_RECORDS),
+            (unsigned long)TRACE_BUFFER_RECORDS);
+}
+
+static const char *trace_task_name(const TaskStatus_t *tasks, UBaseType_t taskCount, uint8_t number)
+{
+    for (UBaseType_t i = 0; i < taskCount; i++)
+    {
+        if (tasks[i].xTaskNumber == number) return tasks[i].pcTaskName;
+    }
+
+    return "Unknown";
+}
+
+static const char *trace_object_name(uint8_t type, uint8_t object)
+{
+    if (type == TRACE_JOB_ROUTED || type == TRACE_JOB_TAKEN)
+        return object < NUM_DEPARTMENTS ? departmentNames[object] : "Unknown";
+
+    return object == TRACE_QUEUE_INCOMING ? "Incoming" : "Queue";
+}
+
+static const char *trace_type_name(uint8_t type)
+{
+    switch (type)
+    {
+        case TRACE_QUEUE_SEND: return "Send";
+        case TRACE_QUEUE_SEND_FAILED: return "Send Failed";
+        case TRACE_QUEUE_RECEIVE: return "Receive";
+        case TRACE_JOB_ROUTED: return "Job Routed";
+        case TRACE_JOB_TAKEN: return "Job Taken";
+        default: return "Unknown";
+    }
+}
+
+// each task is a thread of one process, its time slices run
+// from its switch in to the next, and everything else
+// is an instant event on the thread of the task that did it
+static void trace_write_json(FILE *out, const TaskStatus_t *tasks, UBaseType_t taskCount,
+        uint32_t first, uint32_t count)
+{
+    uint32_t start = traceBuffer[first % TRACE_BUFFER_RECORDS].timestamp;
+    uint32_t sliceStart = 0;
+    int sliceTask = -1;
+    uint32_t at = 0;
+
+    fprintf(out, "{\"traceEvents\":[\n");
+    fprintf(out, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"City\"}}");
+
+    for (UBaseType_t i = 0; i < taskCount; i++)
+    {
+        fprintf(out, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+                (unsigned)tasks[i].xTaskNumber, tasks[i].pcTaskName);
+    }
+
+    for (uint32_t i = first; i < count; i++)
+    {
+        const TraceEntry_t *entry = &(traceBuffer[i % TRACE_BUFFER_RECORDS]);
+
+        // relative to the first record, which is well within one wrap
+        at = entry->timestamp - start;
+
+        if (entry->type != TRACE_TASK_SWITCHED_IN)
+        {
+            fprintf(out, ",\n{\"name\":\"%s %s\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%lu,\"pid\":1,\"tid\":%u}",
+                    trace_type_name(entry->type), trace_object_name(entry->type, entry->object),
+                    (unsigned long)at, (unsigned)entry->task);
+            continue;
+        }
+
+        if (sliceTask >= 0)
+        {
+            fprintf(out, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%lu,\"dur\":%lu,\"pid\":1,\"tid\":%d}",
+                    trace_task_name(tasks, taskCount, sliceTask),
+                    (unsigned long)sliceStart, (unsigned long)(at - sliceStart), sliceTask);
+        }
+
+        sliceTask = entry->object;
+        sliceStart = at;
+    }
+
+    // the task running when recording stopped is cut off at the last record
+    if (sliceTask >= 0 && at > sliceStart)
+    {
+        fprintf(out, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%lu,\"dur\":%lu,\"pid\":1,\"tid\":%d}",
+                trace_task_name(tasks, taskCount, sliceTask),
+                (unsigned long)sliceStart, (unsigned long)(at - sliceStart), sliceTask);
+    }
+
+    fprintf(out, "\n],\"displayTimeUnit\":\"ms\"}\n");
+}
+
+// the logger is held off as well, so that nothing else
+// is printed into the middle of the json on stdout
+void trace_dump(void)
+{
+    UBaseType_t taskCount = uxTaskGetNumberOfTasks();
+    TaskStatus_t *tasks = pvPortMalloc(sizeof(TaskStatus_t) * taskCount);
+    FILE *out = stdout;
+
+    if (tasks == NULL) return;
+    taskCount = uxTaskGetSystemState(tasks, taskCount, NULL);
+
+#ifdef CITY_HOST_BUILD
+    out = fopen(TRACE_HOST_FILE, "w");
+
+    if (out == NULL)
+    {
+        printf("~~ Trace: Can't Open %s\n", TRACE_HOST_FILE);
+        vPortFree(tasks);
+        return;
+    }
+#endif
+
+    tracePaused = true;
+    loggerActiveMask = 0;
+
+    uint32_t count = traceCount;
+    uint32_t first = count > TRACE_BUFFER_RECORDS ? count - TRACE_BUFFER_RECORDS : 0;
+
+    if (count > first) trace_write_json(out, tasks, taskCount, first, count);
+
+    logger_set_behavior(loggerBehavior);
+    tracePaused = false;
+
+#ifdef CITY_HOST_BUILD
+    fclose(out);
+    printf("~~ Trace: %lu Records Written To %s\n", (unsigned long)(count - first), TRACE_HOST_FILE);
+#endif
+
+    vPortFree(tasks);
+}
@@ -0,0 +1,35 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "FreeRTOS.h"
+
+// a flight recorder of context switches and queue traffic, fed by the
+// kernel trace hooks (FreeRTOS-Config/trace_hooks.h). it runs all the
+// time, overwriting its oldest records, and the dump exports whatever
+// it holds as a chrome trace (chrome://tracing, ui.perfetto.dev).
+// the agents poll every tick, so under load the buffer covers
+// somewhere around the last few hundred milliseconds.
+#define TRACE_BUFFER_RECORDS (4096)
+// the host build writes its dump here rather than to stdout
+#define TRACE_HOST_FILE "city_trace.json"
+
+typedef struct TraceEntry
+{
+    uint32_t timestamp; // microseconds, wraps every ~71 minutes
+    uint8_t type;       // TraceRecordType_t
+    uint8_t task;       // the task running at the time
+    uint8_t object;     // the task switched in, the queue or the department
+    uint8_t reserved;
+} TraceEntry_t;
+
+// for records made outside the kernel, from any task
+void trace_mark(TraceRecordType_t type, uint8_t object);
+
+void trace_clear(void);
+void trace_print_stats(void);
+// recording stops for the duration of the dump
+void trace_dump(void);
+
+#endif